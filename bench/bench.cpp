@@ -0,0 +1,451 @@
+#include "flags.h"
+#include "sigscanner/sigscanner.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+
+/*
+ * Benchmarks to compare commits against each other. The corpora are generated from a seed, so every
+ * run with the same seed and scale scans the same bytes, and each result is printed as a line of
+ * JSON. Times are the median (p50) and 99th percentile (p99, nearest rank) over the runs, and the
+ * throughput figures are taken from the median.
+ *
+ * Directory scans are measured with a warm page cache, a first run that isn't counted reads the
+ * files in.
+ */
+
+static std::string binary_name;
+
+void print_help()
+{
+  std::cout << "Benchmark signature scanning on generated corpora\n\n"
+               "Usage: " << binary_name << " [options]\n\n"
+               "Flags:\n"
+               "--dir <path>           - Where to generate the file corpora, reused if it was made with the same seed and scale\n"
+               "--seed <int>           - Seed for the corpora and signatures (default 1)\n"
+               "--scale <float>        - Multiplies the size of every corpus (default 1)\n"
+               "--runs <int>           - Measured runs of each benchmark (default 5)\n"
+               "-j <int>               - Thread count to measure. Can be specified more than once (default 1 and every core)\n"
+               "--filter <text>        - Only run benchmarks whose id contains this\n"
+               "--list                 - Print the ids of the benchmarks instead of running them"
+            << std::endl;
+}
+
+struct settings
+{
+  std::uint64_t seed;
+  double scale;
+  std::size_t runs;
+  std::vector<std::size_t> thread_counts;
+  std::string filter;
+  bool list;
+  std::filesystem::path dir;
+};
+
+struct measurement
+{
+  std::string id;
+  std::string benchmark;
+  std::string corpus;
+  std::string signatures;
+  std::size_t threads;
+  std::string mode;
+  std::uint64_t bytes;
+  std::uint64_t files;
+};
+
+/*
+ * Run a benchmark warmup + settings.runs times and print its line. run returns the number of matches,
+ * which is printed too so results that stop matching stand out.
+ */
+void measure(const settings &settings, const measurement &info, const std::function<std::size_t()> &run)
+{
+  if (!settings.filter.empty() && info.id.find(settings.filter) == std::string::npos)
+  {
+    return;
+  }
+  if (settings.list)
+  {
+    std::cout << info.id << "\n";
+    return;
+  }
+
+  std::size_t matches = run(); // Warmup
+  std::vector<double> seconds;
+  for (std::size_t i = 0; i < settings.runs; i++)
+  {
+    const auto start = std::chrono::steady_clock::now();
+    matches = run();
+    seconds.push_back(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+  }
+  std::sort(seconds.begin(), seconds.end());
+  const auto percentile = [&seconds](double p) {
+      const std::size_t rank = static_cast<std::size_t>(p * static_cast<double>(seconds.size()) + 0.999999);
+      return seconds[std::clamp<std::size_t>(rank, 1, seconds.size()) - 1];
+  };
+  const double p50 = percentile(0.5);
+  const double p99 = percentile(0.99);
+
+  char line[1024];
+  std::snprintf(line, sizeof(line),
+                "{\"id\":\"%s\",\"benchmark\":\"%s\",\"corpus\":\"%s\",\"signatures\":\"%s\",\"threads\":%zu,\"mode\":\"%s\","
+                "\"bytes\":%llu,\"files\":%llu,\"runs\":%zu,\"matches\":%zu,\"p50_ms\":%.3f,\"p99_ms\":%.3f,\"gb_per_s\":%.3f,\"files_per_s\":%.1f}",
+                info.id.c_str(), info.benchmark.c_str(), info.corpus.c_str(), info.signatures.c_str(), info.threads, info.mode.c_str(),
+                static_cast<unsigned long long>(info.bytes), static_cast<unsigned long long>(info.files), settings.runs, matches,
+                p50 * 1000.0, p99 * 1000.0, static_cast<double>(info.bytes) / p50 / 1e9, static_cast<double>(info.files) / p50);
+  std::cout << line << std::endl;
+}
+
+std::vector<sigscanner::byte> random_bytes(std::mt19937_64 &rng, std::size_t size)
+{
+  std::vector<sigscanner::byte> data(size);
+  for (std::size_t i = 0; i < size; i += 8)
+  {
+    const std::uint64_t value = rng();
+    std::memcpy(data.data() + i, &value, std::min<std::size_t>(8, size - i));
+  }
+  return data;
+}
+
+/*
+ * Not real code, but with the byte frequencies of x86-64: common opcodes and prefixes, small
+ * displacements, calls and jumps, and int3 padding between functions.
+ */
+std::vector<sigscanner::byte> x86_like_bytes(std::mt19937_64 &rng, std::size_t size)
+{
+  static const std::vector<std::vector<int>> instructions = {
+      {0x55}, {0x48, 0x89, 0xE5}, {0x48, 0x83, 0xEC, -1}, {0x48, 0x8B, 0x45, -1}, {0x48, 0x89, 0x45, -1}, {0x8B, 0x45, -1},
+      {0xE8, -2, -2, -2, -2}, {0x48, 0x8D, 0x05, -2, -2, -2, -2}, {0x85, 0xC0}, {0x74, -1}, {0x75, -1}, {0x31, 0xC0},
+      {0xB8, -2, -2, 0x00, 0x00}, {0x48, 0x8B, 0x7D, -1}, {0x0F, 0x1F, 0x44, 0x00, 0x00}, {0xE9, -2, -2, -2, -2}, {0x5D}, {0xC3},
+  };
+  std::vector<sigscanner::byte> data;
+  data.reserve(size + 16);
+  std::size_t function_length = 0;
+  while (data.size() < size)
+  {
+    // Functions end with a ret and are padded to 16 bytes
+    if (function_length > 32 && rng() % 64 == 0)
+    {
+      data.push_back(0xC3);
+      while (data.size() % 16 != 0)
+      {
+        data.push_back(0xCC);
+      }
+      function_length = 0;
+      continue;
+    }
+    for (const int value: instructions[rng() % instructions.size()])
+    {
+      // -1 is a small displacement, -2 a byte of a larger immediate
+      data.push_back(static_cast<sigscanner::byte>(value >= 0 ? value : value == -1 ? (rng() % 64) * 8 : rng() % 256));
+      function_length++;
+    }
+  }
+  data.resize(size);
+  return data;
+}
+
+std::string to_pattern(const std::vector<int> &bytes)
+{
+  std::string pattern;
+  char hex[3];
+  for (const int value: bytes)
+  {
+    if (!pattern.empty())
+    {
+      pattern += ' ';
+    }
+    if (value < 0)
+    {
+      pattern += "??";
+    } else
+    {
+      std::snprintf(hex, sizeof(hex), "%02X", static_cast<unsigned>(static_cast<unsigned char>(value)));
+      pattern += hex;
+    }
+  }
+  return pattern;
+}
+
+// Random pattern of length bytes, wildcard_every > 0 makes every nth byte (after the first) a wildcard
+std::string random_pattern(std::mt19937_64 &rng, std::size_t length, std::size_t wildcard_every = 0, std::size_t leading_wildcards = 0)
+{
+  std::vector<int> bytes;
+  for (std::size_t i = 0; i < leading_wildcards; i++)
+  {
+    bytes.push_back(-1);
+  }
+  for (std::size_t i = 0; i < length; i++)
+  {
+    bytes.push_back(wildcard_every > 0 && i > 0 && i % wildcard_every == 0 ? -1 : static_cast<int>(rng() % 256));
+  }
+  return to_pattern(bytes);
+}
+
+std::vector<std::pair<std::string, sigscanner::signature>> signature_shapes(std::mt19937_64 &rng)
+{
+  return {
+      {"exact_4", sigscanner::signature(random_pattern(rng, 4))},
+      {"exact_16", sigscanner::signature(random_pattern(rng, 16))},
+      {"exact_48", sigscanner::signature(random_pattern(rng, 48))},
+      {"wildcards_12", sigscanner::signature(random_pattern(rng, 12, 3))},
+      {"leading_wildcards", sigscanner::signature(random_pattern(rng, 6, 0, 3))},
+      {"x86_common", sigscanner::signature("48 8B 45 ??")},
+  };
+}
+
+std::vector<sigscanner::signature> signature_set(std::mt19937_64 &rng, std::size_t count)
+{
+  std::vector<sigscanner::signature> signatures;
+  for (std::size_t i = 0; i < count; i++)
+  {
+    // Drawn one at a time, argument evaluation order would make the set depend on the compiler
+    const std::size_t length = 6 + rng() % 11;
+    const std::size_t wildcard_every = 2 + rng() % 5;
+    signatures.emplace_back(random_pattern(rng, length, wildcard_every));
+  }
+  return signatures;
+}
+
+void write_file(const std::filesystem::path &path, const std::vector<sigscanner::byte> &data)
+{
+  std::filesystem::create_directories(path.parent_path());
+  std::ofstream file(path, std::ios::out | std::ios::binary | std::ios::trunc);
+  file.write(reinterpret_cast<const char *>(data.data()), static_cast<std::streamsize>(data.size()));
+}
+
+struct corpus
+{
+  std::filesystem::path path;
+  std::uint64_t bytes = 0;
+  std::uint64_t files = 0;
+};
+
+/*
+ * many_small: files from 64 bytes to 16KB spread over 100 directories, like a tree of sources and configs.
+ * few_huge: two files of mixed random and code-like bytes, big enough to be split by AUTO.
+ */
+std::pair<corpus, corpus> generate_file_corpora(const settings &settings)
+{
+  corpus small{settings.dir / "many_small"};
+  corpus huge{settings.dir / "few_huge"};
+  const std::size_t small_count = static_cast<std::size_t>(20000 * settings.scale);
+  const std::size_t huge_size = static_cast<std::size_t>(256.0 * 1024 * 1024 * settings.scale);
+
+  std::ostringstream description;
+  description << "seed " << settings.seed << " scale " << settings.scale << "\n";
+  const std::filesystem::path marker = settings.dir / "corpus.txt";
+  std::string existing;
+  if (std::ifstream marker_file(marker); marker_file)
+  {
+    std::getline(marker_file, existing);
+    existing += "\n";
+  }
+  const bool reuse = existing == description.str();
+  if (!reuse)
+  {
+    std::cerr << "Generating corpora in " << settings.dir << std::endl;
+    std::filesystem::remove_all(small.path);
+    std::filesystem::remove_all(huge.path);
+    std::filesystem::remove(marker);
+  }
+
+  // Sizes come from their own generator so they are known without generating the contents again
+  std::mt19937_64 size_rng(settings.seed + 1);
+  std::mt19937_64 rng(settings.seed + 2);
+  for (std::size_t i = 0; i < small_count; i++)
+  {
+    const std::size_t size = static_cast<std::size_t>(64.0 * std::pow(256.0, std::uniform_real_distribution<double>(0, 1)(size_rng)));
+    const std::filesystem::path path = small.path / ("dir" + std::to_string(i % 100)) / ("file" + std::to_string(i) + (i % 3 == 0 ? ".bin" : ".txt"));
+    if (!reuse)
+    {
+      write_file(path, i % 2 == 0 ? random_bytes(rng, size) : x86_like_bytes(rng, size));
+    }
+    small.bytes += size;
+    small.files++;
+  }
+  for (std::size_t i = 0; i < 2; i++)
+  {
+    if (!reuse)
+    {
+      std::vector<sigscanner::byte> data = random_bytes(rng, huge_size / 2);
+      const std::vector<sigscanner::byte> code = x86_like_bytes(rng, huge_size - huge_size / 2);
+      data.insert(data.end(), code.begin(), code.end());
+      write_file(huge.path / ("huge" + std::to_string(i) + ".bin"), data);
+    }
+    huge.bytes += huge_size;
+    huge.files++;
+  }
+
+  if (!reuse)
+  {
+    std::ofstream(marker) << description.str();
+  }
+  return {small, huge};
+}
+
+std::string mode_name(sigscanner::scan_options::threading_mode mode)
+{
+  switch (mode)
+  {
+    case sigscanner::scan_options::threading_mode::PER_CHUNK:
+      return "per_chunk";
+    case sigscanner::scan_options::threading_mode::PER_FILE:
+      return "per_file";
+    case sigscanner::scan_options::threading_mode::AUTO:
+      return "auto";
+  }
+  return "";
+}
+
+std::size_t count_matches(const std::unordered_map<sigscanner::signature, std::vector<sigscanner::offset>> &results)
+{
+  std::size_t matches = 0;
+  for (const auto &[signature, offsets]: results)
+  {
+    matches += offsets.size();
+  }
+  return matches;
+}
+
+int main(int argc, char **argv)
+{
+  binary_name = std::filesystem::path(argv[0]).filename().string();
+  const flags::args args(argc, argv);
+  if (args.get<bool>("h") || args.get<bool>("help"))
+  {
+    print_help();
+    return 0;
+  }
+
+  settings settings;
+  settings.seed = args.get<std::uint64_t>("seed", 1);
+  settings.scale = args.get<double>("scale", 1.0);
+  settings.runs = std::max<std::size_t>(args.get<std::size_t>("runs", 5), 1);
+  settings.filter = args.get<std::string>("filter", "");
+  settings.list = args.get<bool>("list").value_or(false);
+  settings.dir = args.get<std::string>("dir", (std::filesystem::temp_directory_path() / "sigscanner-bench").string());
+  for (const std::string_view threads: args.values("j"))
+  {
+    settings.thread_counts.push_back(std::max<std::size_t>(std::stoul(std::string(threads)), 1));
+  }
+  if (settings.thread_counts.empty())
+  {
+    settings.thread_counts = {1, std::max<std::size_t>(std::thread::hardware_concurrency(), 1)};
+    settings.thread_counts.erase(std::unique(settings.thread_counts.begin(), settings.thread_counts.end()), settings.thread_counts.end());
+  }
+
+  std::mt19937_64 rng(settings.seed);
+  const std::size_t memory_size = static_cast<std::size_t>(64.0 * 1024 * 1024 * settings.scale);
+  const std::vector<std::pair<std::string, std::vector<sigscanner::byte>>> buffers = {
+      {"random", random_bytes(rng, memory_size)},
+      {"x86", x86_like_bytes(rng, memory_size)},
+  };
+  const std::vector<std::pair<std::string, sigscanner::signature>> shapes = signature_shapes(rng);
+  std::vector<std::pair<std::size_t, std::vector<sigscanner::signature>>> sets;
+  for (const std::size_t count: {1, 16, 256})
+  {
+    sets.emplace_back(count, signature_set(rng, count));
+  }
+
+  // signature::scan, one signature on one thread
+  for (const auto &[corpus_name, data]: buffers)
+  {
+    for (const auto &[shape, sig]: shapes)
+    {
+      measure(settings, {"signature_scan/" + corpus_name + "/" + shape, "signature_scan", corpus_name, shape, 1, "", data.size(), 0}, [&sig = sig, &data = data] {
+          return sig.scan(data.data(), data.size(), 0).size();
+      });
+    }
+  }
+
+  // scanner::scan called once per small buffer, where returning a vector costs more than the scan itself
+  constexpr std::size_t small_buffer_size = 256;
+  for (const auto &[corpus_name, data]: buffers)
+  {
+    const sigscanner::scanner scanner(shapes.back().second);
+    measure(settings, {"small_buffers/" + corpus_name + "/vector", "small_buffers", corpus_name, shapes.back().first, 1, "vector", data.size(), 0},
+            [&scanner, &data = data] {
+        std::size_t matches = 0;
+        for (std::size_t pos = 0; pos + small_buffer_size <= data.size(); pos += small_buffer_size)
+        {
+          matches += scanner.scan(data.data() + pos, small_buffer_size).size();
+        }
+        return matches;
+    });
+    measure(settings, {"small_buffers/" + corpus_name + "/span", "small_buffers", corpus_name, shapes.back().first, 1, "span", data.size(), 0},
+            [&scanner, &data = data] {
+        std::array<sigscanner::offset, small_buffer_size> offsets;
+        bool overflowed;
+        std::size_t matches = 0;
+        for (std::size_t pos = 0; pos + small_buffer_size <= data.size(); pos += small_buffer_size)
+        {
+          matches += scanner.scan(data.data() + pos, small_buffer_size, offsets.data(), offsets.size(), overflowed);
+        }
+        return matches;
+    });
+  }
+
+  // multi_scanner::scan over a buffer
+  for (const auto &[corpus_name, data]: buffers)
+  {
+    for (const auto &[count, signatures]: sets)
+    {
+      const sigscanner::multi_scanner scanner(signatures);
+      for (const std::size_t threads: settings.thread_counts)
+      {
+        sigscanner::scan_options options;
+        options.set_thread_count(threads);
+        measure(settings, {"multi_scan/" + corpus_name + "/sigs" + std::to_string(count) + "/t" + std::to_string(threads), "multi_scan", corpus_name,
+                           std::to_string(count), threads, "", data.size(), 0}, [&scanner, &options, &data = data] {
+            return count_matches(scanner.scan(data.data(), data.size(), options));
+        });
+      }
+    }
+  }
+
+  // multi_scanner::scan_directory, counting matches through a sink so collecting results isn't measured
+  if (settings.list || settings.filter.empty() || settings.filter.find("scan_directory") != std::string::npos)
+  {
+    const auto [small, huge] = settings.list ? std::pair<corpus, corpus>{{settings.dir / "many_small"}, {settings.dir / "few_huge"}} : generate_file_corpora(settings);
+    for (const corpus &files: {small, huge})
+    {
+      for (const auto &[count, signatures]: sets)
+      {
+        if (count == 16)
+        {
+          continue;
+        }
+        const sigscanner::multi_scanner scanner(signatures);
+        for (const std::size_t threads: settings.thread_counts)
+        {
+          for (const auto mode: {sigscanner::scan_options::threading_mode::PER_FILE, sigscanner::scan_options::threading_mode::PER_CHUNK,
+                                 sigscanner::scan_options::threading_mode::AUTO})
+          {
+            sigscanner::scan_options options;
+            options.set_thread_count(threads);
+            options.set_threading_mode(mode);
+            const std::string corpus_name = files.path.filename().string();
+            measure(settings, {"scan_directory/" + corpus_name + "/sigs" + std::to_string(count) + "/t" + std::to_string(threads) + "/" + mode_name(mode),
+                               "scan_directory", corpus_name, std::to_string(count), threads, mode_name(mode), files.bytes, files.files},
+                    [&scanner, &options, &files] {
+                        std::size_t matches = 0;
+                        scanner.scan_directory(files.path, [&matches](const std::filesystem::path &, const std::vector<sigscanner::match> &found) {
+                            matches += found.size();
+                        }, options);
+                        return matches;
+                    });
+          }
+        }
+      }
+    }
+  }
+  return 0;
+}
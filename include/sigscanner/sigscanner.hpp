@@ -1,5 +1,6 @@
 #pragma once
 
+#include <string>
 #include <string_view>
 #include <utility>
 #include <vector>
@@ -10,38 +11,217 @@
 #include <thread>
 #include <atomic>
 #include <mutex>
+#include <condition_variable>
+#include <deque>
 #include <initializer_list>
+#include <memory>
+#include <array>
+#include <chrono>
+#include <optional>
+#include <map>
+#include <iosfwd>
 
 #ifndef SIGSCANNER_FILE_BLOCK_SIZE
 #define SIGSCANNER_FILE_BLOCK_SIZE static_cast<std::uint64_t>(1'048'576ull) // 1MB
 #endif
 
+#ifndef SIGSCANNER_ASYNC_READ_DEPTH
+#define SIGSCANNER_ASYNC_READ_DEPTH 4 // Blocks each worker has buffered for read_mode::ASYNC, all but one are being read
+#endif
+
+#ifndef SIGSCANNER_MAPPED_RANGE_SIZE
+#define SIGSCANNER_MAPPED_RANGE_SIZE static_cast<std::uint64_t>(16'777'216ull) // 16MB, memory mapped files are split into ranges of this size
+#endif
+
+#ifndef SIGSCANNER_FILE_BATCH_SIZE
+#define SIGSCANNER_FILE_BATCH_SIZE static_cast<std::uint64_t>(4'194'304ull) // 4MB, files no bigger than a block found in a directory are scanned in batches of about this many bytes
+#endif
+
+#ifndef SIGSCANNER_MAX_BYTES_IN_FLIGHT
+#define SIGSCANNER_MAX_BYTES_IN_FLIGHT static_cast<std::uint64_t>(268'435'456ull) // 256MB, default for scan_options::set_max_bytes_in_flight
+#endif
+
+#ifndef SIGSCANNER_AUTO_SPLIT_SIZE
+#define SIGSCANNER_AUTO_SPLIT_SIZE static_cast<std::uint64_t>(33'554'432ull) // 32MB, threading_mode::AUTO splits files this big into SIGSCANNER_MAPPED_RANGE_SIZE ranges
+#endif
+
+#ifndef SIGSCANNER_HORSPOOL_MIN_LENGTH
+#define SIGSCANNER_HORSPOOL_MIN_LENGTH 32 // Shorter signatures can't skip far enough to be worth it
+#endif
+
+#ifndef SIGSCANNER_AUTOMATON_MIN_SIGNATURES
+#define SIGSCANNER_AUTOMATON_MIN_SIGNATURES 128 // Fewer signatures are faster to scan one by one with the SIMD kernels
+#endif
+
+#ifndef SIGSCANNER_MAX_OPEN_DIRECTORIES
+#define SIGSCANNER_MAX_OPEN_DIRECTORIES 256 // Directories kept open while walking so subdirectories can be opened relative to them
+#endif
+
+#ifndef SIGSCANNER_AUTOMATON_KEY_LENGTH
+#define SIGSCANNER_AUTOMATON_KEY_LENGTH 4
+#endif
+
+#ifndef SIGSCANNER_INDEX_GRAM_LENGTH
+#define SIGSCANNER_INDEX_GRAM_LENGTH 4 // 1 to 4. corpus_index records n-grams of this many bytes, only literal runs at least this long narrow down a query
+#endif
+
+#ifndef SIGSCANNER_INDEX_BLOCK_SIZE
+#define SIGSCANNER_INDEX_BLOCK_SIZE static_cast<std::uint64_t>(262'144ull) // 256KB, corpus_index records which n-grams appear in each block of this size
+#endif
+
+#ifndef SIGSCANNER_INDEX_RUN_SIZE
+#define SIGSCANNER_INDEX_RUN_SIZE static_cast<std::uint64_t>(67'108'864ull) // 64MB, corpus_index::build sorts each thread's n-grams to disk whenever it has this many bytes of them
+#endif
+
+#ifndef SIGSCANNER_INDEX_MERGE_WIDTH
+#define SIGSCANNER_INDEX_MERGE_WIDTH 64 // Sorted runs corpus_index::build merges at once. More are merged in several passes
+#endif
+
 namespace sigscanner
 {
     typedef std::uint8_t byte;
     typedef std::uint64_t offset;
 
+    /*
+     * Instruction sets used by signature::scan and signature::reverse_scan. The highest level the CPU
+     * supports is detected at startup. Every level gives identical results.
+     */
+    enum class simd_level
+    {
+        SCALAR,
+        SSE2,
+        AVX2,
+        AVX512 // AVX-512F + AVX-512BW
+    };
+
+    simd_level get_max_simd_level(); // Highest level supported by this CPU
+    simd_level get_simd_level(); // Level currently in use
+    void set_simd_level(simd_level level); // Clamped to get_max_simd_level()
+
+    class stats_shards;
+
+    /*
+     * Each worker has its own queue. Tasks added from a worker go to its queue, tasks added from
+     * other threads go to a shared queue, and workers that run out steal from the others. Idle
+     * workers sleep until a task is added.
+     *
+     * A pool can be kept between scans and shared by several of them at once, see scan_options::set_thread_pool.
+     */
     class thread_pool
     {
     public:
         thread_pool() = default;
+        explicit thread_pool(std::size_t count);
         ~thread_pool();
+        thread_pool(const thread_pool &copy) = delete;
+        thread_pool &operator=(const thread_pool &copy) = delete;
 
         void create(std::size_t count);
-        void destroy(bool force = false);
+        void destroy(bool force = false); // Unless forced, queued tasks are finished first
+        std::size_t size() const;
 
         void add_task(std::function<void()> &&task);
+        /*
+         * Sized tasks are run before any other queued task, largest first. Meant for the pieces of
+         * big jobs, so they are started early instead of leaving one worker busy after the rest are done.
+         */
+        void add_task(std::function<void()> &&task, std::uint64_t size);
+        void wait(); // Block until every task has finished, including ones added by tasks
+        bool run_pending_task(); // Run one queued task on the calling thread. False if there were none
+
+        /*
+         * Tasks added through a group can be waited on without waiting for the rest of the pool, so
+         * scans sharing a pool only wait for their own work. Waiting helps with the group's own queued
+         * tasks but never another's, whose length has nothing to do with it. The destructor waits for the group.
+         */
+        class task_group
+        {
+        public:
+            // With stats set every task counts itself and the time it spent queued into the running thread's counters
+            explicit task_group(thread_pool &pool, stats_shards *stats = nullptr);
+            ~task_group();
+            task_group(const task_group &copy) = delete;
+            task_group &operator=(const task_group &copy) = delete;
+
+            void add_task(std::function<void()> &&task);
+            void add_task(std::function<void()> &&task, std::uint64_t size);
+            void wait(); // Runs the group's queued tasks while waiting, so this is safe to call from a task
+
+        private:
+            std::function<void()> track(std::function<void()> &&task);
+
+            thread_pool &pool;
+            stats_shards *const stats;
+            std::atomic<std::size_t> pending = 0;
+            std::atomic<std::size_t> queued = 0; // Of the pending tasks, the ones no thread has taken yet
+            std::mutex mutex;
+            std::condition_variable condition;
+
+            friend thread_pool;
+        };
 
     private:
-        void thread_loop();
+        struct queued_task
+        {
+            std::function<void()> task;
+            task_group *group; // Null unless added through a group
+        };
+
+        struct task_queue
+        {
+            std::deque<queued_task> tasks;
+            std::mutex mutex;
+        };
+
+        struct sized_task
+        {
+            std::uint64_t size;
+            std::function<void()> task;
+            task_group *group;
+
+            bool operator<(const sized_task &other) const
+            {
+              return this->size < other.size;
+            }
+        };
+
+        void push_task(std::function<void()> &&task, task_group *group);
+        void push_task(std::function<void()> &&task, std::uint64_t size, task_group *group);
+        void thread_loop(std::size_t index);
+        void wake_worker();
+        // With group set only its tasks are taken
+        bool pop_task(std::size_t index, std::function<void()> &task, const task_group *group = nullptr);
+        bool run_group_task(const task_group &group);
+        void run_task(std::function<void()> &task);
+        void finish_task();
+
         std::vector<std::thread> threads;
+        std::vector<std::unique_ptr<task_queue>> queues; // One per worker
+        task_queue shared_queue;
+        std::vector<sized_task> sized_tasks; // Max heap by size
+        std::mutex sized_mutex;
+        std::atomic<std::size_t> sized_queued = 0;
         std::atomic<bool> running = false;
         std::atomic<bool> force_stop = false;
 
-        std::vector<std::function<void()>> tasks;
-        std::mutex tasks_mutex;
+        std::atomic<std::size_t> queued = 0; // Tasks waiting in any queue
+        std::atomic<std::size_t> pending = 0; // Tasks queued or running
+        std::atomic<std::size_t> sleeping = 0;
+        std::mutex park_mutex;
+        std::condition_variable park_condition;
+        std::mutex idle_mutex;
+        std::condition_variable idle_condition;
     };
 
+    class aho_corasick;
+    class mapped_file;
+    class corpus_index;
+
+    namespace kernels
+    {
+        struct pattern_view;
+    }
+
     class signature
     {
     public:
@@ -70,13 +250,63 @@ namespace sigscanner
 
         // Members
         bool check(const byte *data, std::size_t size) const;
-        std::vector<offset> scan(const byte *data, std::size_t size, offset base) const;
-        std::vector<offset> reverse_scan(const byte *data, std::size_t size, offset base) const;
+        std::vector<offset> scan(const byte *data, std::size_t size, offset base, std::size_t max_matches = 0) const; // 0 for no limit
+        std::vector<offset> reverse_scan(const byte *data, std::size_t size, offset base, std::size_t max_matches = 0) const;
+        // Also add the number of positions that were verified against the whole pattern to candidates
+        std::vector<offset> scan(const byte *data, std::size_t size, offset base, std::size_t max_matches, std::uint64_t &candidates) const;
+        std::vector<offset> reverse_scan(const byte *data, std::size_t size, offset base, std::size_t max_matches, std::uint64_t &candidates) const;
+
+        /*
+         * Call visit(offset) for each match in ascending order, allocating nothing. visit returns false
+         * to stop, and so does this. Defined here so visit can be inlined into the loop. Matches are
+         * found a few dozen at a time, so candidates may count some past where visit stopped.
+         */
+        template<typename visitor>
+        bool for_each_match(const byte *data, std::size_t size, offset base, visitor &&visit) const;
+        template<typename visitor>
+        bool for_each_match(const byte *data, std::size_t size, offset base, visitor &&visit, std::uint64_t &candidates) const;
+        /*
+         * Write the first matches to out, up to capacity, and return how many were written. overflowed is
+         * set if there were more, a scan starting after the last one written finds them.
+         */
+        std::size_t scan(const byte *data, std::size_t size, offset base, offset *out, std::size_t capacity, bool &overflowed) const;
+
         std::size_t size() const;
 
+        /*
+         * Describes how scan() finds candidates. Positions are only verified if the bytes at
+         * offset and second_offset match, so the lower candidate_rate the faster the scan.
+         */
+        struct anchor_info
+        {
+            std::size_t offset = 0; // Rarest BYTE in the pattern, searched for first
+            byte value = 0;
+            std::size_t second_offset = 0; // Next rarest BYTE, checked before verifying
+            byte second_value = 0;
+            double candidate_rate = 1.0; // Expected fraction of positions verified in machine code
+            std::size_t run_offset = 0; // Longest run of BYTEs without a wildcard
+            std::size_t run_length = 0;
+        };
+        anchor_info anchor() const;
+
+        /*
+         * How scan() searches. The engine expected to be fastest on machine code at the current
+         * simd_level is picked on construction, setting one that isn't available for this signature
+         * is ignored. reverse_scan() always uses ANCHORED.
+         */
+        enum class engine
+        {
+            ANCHORED, // SIMD or memchr search for the anchors described by anchor()
+            HORSPOOL // Boyer-Moore-Horspool skipping, only for signatures of at least SIGSCANNER_HORSPOOL_MIN_LENGTH
+        };
+        engine get_engine() const;
+        void set_engine(engine new_engine);
+
         // Allow std::hash to not hash on every call
         template<typename T> friend
         struct std::hash;
+        friend aho_corasick;
+        friend corpus_index;
 
     public:
         enum class mask_type : bool
@@ -90,12 +320,183 @@ namespace sigscanner
         std::vector<mask_type> mask;
         std::size_t length = 0;
         std::size_t hash = 0;
+        // Rarest BYTE positions, compared before verifying a candidate. Equal to length if there are none
+        std::size_t first_anchor = 0;
+        std::size_t second_anchor = 0;
+        // Horspool bad character shifts for the window ending at horspool_end. Empty if unavailable.
+        // The byte at horspool_end has a shift of 0, horspool_match_shift is its real shift
+        std::vector<std::uint16_t> horspool_shift;
+        std::size_t horspool_end = 0;
+        std::size_t horspool_match_shift = 0;
+        engine selected_engine = engine::ANCHORED;
+        // pattern and mask packed into words for verifying, see kernels::pack. Inline up to 32 bytes, otherwise on the heap
+        static constexpr std::size_t inline_packed_words = 8;
+        std::array<std::uint64_t, inline_packed_words> inline_packed{};
+        std::vector<std::uint64_t> heap_packed;
 
         void update_hash();
+        void update_anchors();
+        void update_engine();
+        void update_packed();
+        const std::uint64_t *packed() const;
+        kernels::pattern_view view(std::uint64_t *candidates) const;
+        // Write the positions of up to capacity matches at or after start to positions. Fewer only once there are no more
+        std::size_t find_matches(const byte *data, std::size_t size, std::size_t start, std::size_t *positions, std::size_t capacity, std::uint64_t *candidates) const;
+        template<typename visitor>
+        bool for_each_match_internal(const byte *data, std::size_t size, offset base, visitor &visit, std::uint64_t *candidates) const;
+        std::vector<offset> scan_internal(const byte *data, std::size_t size, offset base, std::size_t max_matches, std::uint64_t *candidates) const;
+        std::vector<offset> reverse_scan_internal(const byte *data, std::size_t size, offset base, std::size_t max_matches, std::uint64_t *candidates) const;
+    };
+
+    struct match
+    {
+        std::size_t signature; // Index into multi_scanner::get_signatures()
+        sigscanner::offset offset;
+        sigscanner::offset address; // Virtual address offset is loaded at in ELF files scanned with scan_options::set_elf_mode, otherwise equal to offset
+    };
+
+    /*
+     * Receives the matches found in one chunk of a file as soon as that chunk is scanned. Calls come
+     * from the worker threads but never overlap, so the sink doesn't need its own locking. Offsets
+     * of a signature are ascending within a call, but chunks of a file may be reported in any order.
+     */
+    typedef std::function<void(const std::filesystem::path &path, const std::vector<match> &matches)> match_sink;
+
+    /*
+     * A mapping in the address space of another process, as listed in /proc/<pid>/maps. See
+     * multi_scanner::scan_process.
+     */
+    struct process_region
+    {
+        std::uint64_t start = 0;
+        std::uint64_t end = 0; // Exclusive
+        std::string permissions; // Like "r-xp"
+        std::uint64_t file_offset = 0; // Where start is in the mapped file
+        std::string name; // The mapped file, a pseudo path like [heap] or [stack], or empty for anonymous memory
+
+        bool operator<(const process_region &other) const; // By address
+    };
+
+    std::vector<process_region> get_process_regions(int pid); // Every mapping of the process by address. Empty if they can't be listed, or not on Linux
+
+    // Like match_sink, with the offsets of the matches being virtual addresses in region
+    typedef std::function<void(const process_region &region, const std::vector<match> &matches)> region_sink;
+
+    /*
+     * What a scan spent its time on, see scan_options::set_stats. Every thread counts into its own copy
+     * and those are only added up once the scan has finished, so collecting them costs next to nothing.
+     * Times are summed over all threads, with several threads they add up to more than the scan took.
+     */
+    struct scan_stats
+    {
+        std::uint64_t files_visited = 0; // Passed the extension and filename filters, or the one file given
+        std::uint64_t files_skipped = 0; // Visited but neither scanned nor cached: filtered by size, empty, unreadable or dropped after a limit was reached
+        std::uint64_t files_scanned = 0;
+        std::uint64_t files_cached = 0; // Answered from scan_options::set_cache without being read
+        std::uint64_t bytes_read = 0; // Not counting the overlap read twice where chunks meet
+        std::uint64_t tasks_executed = 0;
+        std::chrono::nanoseconds read_time{0}; // With read_mode::MMAP pages are read as they are matched, so that counts as match time
+        std::chrono::nanoseconds match_time{0};
+        std::chrono::nanoseconds lock_wait_time{0}; // Waiting for the lock that keeps calls to a match_sink from overlapping
+        std::chrono::nanoseconds queue_wait_time{0}; // Between a task being queued and starting to run
+
+        struct signature_counts
+        {
+            std::uint64_t candidates = 0; // Positions verified against the whole signature
+            std::uint64_t verified = 0; // Candidates that matched
+        };
+        std::vector<signature_counts> signatures; // Indexed like multi_scanner::get_signatures()
+
+        scan_stats &operator+=(const scan_stats &other);
+    };
+
+    /*
+     * Stops scans from another thread. Copies share the same state, so keep a copy of the token given
+     * to scan_options::set_cancellation_token and cancel that.
+     */
+    class cancellation_token
+    {
+    public:
+        cancellation_token();
+
+        void cancel();
+        bool is_cancelled() const;
+
+    private:
+        std::shared_ptr<std::atomic<bool>> cancelled;
+    };
+
+    class cache_session;
+
+    /*
+     * Results of earlier scans kept on disk, so scans given the cache with scan_options::set_cache only
+     * read files that are new or have changed. A file is recognised by its device, inode, size and
+     * modification time, and its results are only reused by scanners with the same signatures in the
+     * same order.
+     *
+     * The file is mapped and searched in place rather than parsed, and is only ever replaced as a
+     * whole, so any number of processes can use it while another one saves it.
+     */
+    class scan_cache
+    {
+    public:
+        explicit scan_cache(std::filesystem::path path); // Starts empty if path doesn't exist or isn't a valid cache
+        ~scan_cache();
+        scan_cache(const scan_cache &copy) = delete;
+        scan_cache &operator=(const scan_cache &copy) = delete;
+
+        /*
+         * Write the cache to a temporary file and rename it over path. Older results of files that were
+         * scanned again are dropped, and unless keep_unused is set so are the results no scan has used
+         * since they were loaded. Must not be called while a scan is using the cache.
+         */
+        bool save(bool keep_unused = true);
+
+    private:
+        struct key
+        {
+            std::uint64_t signature_set; // See hash_signatures
+            std::uint64_t device;
+            std::uint64_t inode;
+            std::uint64_t size;
+            std::int64_t modified; // As the platform reports it, nanoseconds since the epoch on POSIX
+
+            bool operator<(const key &other) const;
+            bool operator==(const key &other) const;
+        };
+        struct record; // A file's results as stored
+        struct stored_match;
+
+        static std::uint64_t hash_signatures(const std::vector<signature> &signatures);
+        // Nothing unless path is a regular file that can be opened for reading
+        static std::optional<key> identify(const std::filesystem::path &path, std::uint64_t signature_set);
+
+        // Copies the results of file into matches, sorted by signature then offset. False if it has none
+        bool find(const key &file, std::vector<match> &matches);
+        void add(const key &file, std::vector<match> &&matches); // Sorted like find returns them
+        bool in_range(const record &loaded) const; // Whether its matches are inside the file
+
+        void load();
+        void unload();
+
+        const std::filesystem::path path;
+        std::unique_ptr<const mapped_file> mapping;
+        const record *records = nullptr; // Sorted by key
+        std::size_t record_count = 0;
+        const stored_match *matches = nullptr; // Each record's matches follow the previous record's
+        std::size_t match_count = 0;
+        std::unique_ptr<std::atomic<bool>[]> used; // One per record
+        std::map<key, std::vector<match>> added; // Since loading
+        std::mutex added_mutex;
+
+        friend cache_session;
     };
 
     class multi_scanner;
     class scanner;
+    class scan_limits;
+    class directory_walker;
+    class block_pool;
 
     class scan_options
     {
@@ -110,8 +511,46 @@ namespace sigscanner
         void set_file_size_min(std::int64_t size); // -1 to disable (default)
         void set_file_size_max(std::int64_t size); // -1 to disable (default)
         void set_thread_count(std::size_t count);
+        void set_thread_pool(std::shared_ptr<thread_pool> pool); // Run on this pool instead of the scanner's own. thread_count is ignored
         enum class threading_mode;
         void set_threading_mode(threading_mode mode);
+        enum class read_mode;
+        void set_read_mode(read_mode mode);
+        // With PER_CHUNK chunks are scanned by the reading thread instead of queued once this many bytes are waiting. Rounded down to whole blocks
+        void set_max_bytes_in_flight(std::uint64_t bytes);
+
+        /*
+         * Scans stop as soon as one of these is reached, queued work is dropped rather than run.
+         * With more than one thread which matches are kept is unspecified.
+         */
+        void set_max_matches(std::size_t count); // Across all signatures and files. 0 for no limit (default)
+        void set_first_match_per_file(bool enabled); // Stop scanning a file after the first match of any signature in it
+        void set_deadline(std::chrono::steady_clock::time_point time);
+        void set_cancellation_token(const cancellation_token &token);
+
+        /*
+         * The counters of every scan run with these options are added to stats when it finishes, so
+         * scans sharing it must not run at the same time. nullptr to disable (default)
+         */
+        void set_stats(scan_stats *stats);
+
+        /*
+         * Answer files from cache when they haven't changed since they were last scanned, and add the
+         * results of the ones that have. Scans that stop early add nothing, since they can't tell which
+         * files were finished. Scans sharing a cache may run at once. nullptr to disable (default)
+         */
+        void set_cache(scan_cache *cache);
+
+        /*
+         * Only scan the code of ELF files, found from their headers. Files that aren't ELF are scanned
+         * whole, and scan_index, buffers and process memory aren't affected. The cache isn't used, since
+         * it holds the results of whole files.
+         */
+        enum class elf_mode;
+        void set_elf_mode(elf_mode mode);
+        void add_elf_section(std::string_view section); // With SECTIONS scan these instead of every executable section, like ".text"
+        void add_elf_sections(std::initializer_list<std::string_view> sections);
+        void add_elf_sections(const std::vector<std::string_view> &sections);
 
         enum class extension_checking_mode;
         void set_extension_checking_mode(extension_checking_mode mode);
@@ -135,7 +574,22 @@ namespace sigscanner
         enum class threading_mode
         {
             PER_CHUNK, // New task for each chunk. Better for a small number of files
-            PER_FILE // New task for each file. Better for a large number of files (default)
+            PER_FILE, // New task for each file. Better for a large number of files (default)
+            AUTO // PER_FILE for most files, but files of SIGSCANNER_AUTO_SPLIT_SIZE or more are split into ranges that run before anything else, biggest file first
+        };
+
+        enum class read_mode
+        {
+            STREAM, // Copy blocks of the file into memory (default)
+            MMAP, // Memory map the file and scan it in place. Falls back to STREAM if the file can't be mapped
+            ASYNC // Read blocks ahead with io_uring (pread on older kernels) while scanning. Falls back to STREAM on Windows and for special files
+        };
+
+        enum class elf_mode
+        {
+            DISABLED, // Scan every byte of every file (default)
+            SEGMENTS, // Loadable segments that are executable (PT_LOAD with PF_X)
+            SECTIONS // Sections holding instructions (SHF_EXECINSTR) or the ones added with add_elf_section. SEGMENTS for files without a section table
         };
 
         // For either modes if no extensions are specified, all files are scanned
@@ -156,7 +610,18 @@ namespace sigscanner
         std::int64_t min_size = -1;
         std::int64_t max_size = -1;
         std::size_t thread_count = 1;
+        std::shared_ptr<thread_pool> pool;
         threading_mode threading = threading_mode::PER_FILE;
+        read_mode read = read_mode::STREAM;
+        std::uint64_t max_bytes_in_flight = SIGSCANNER_MAX_BYTES_IN_FLIGHT;
+        std::size_t max_matches = 0;
+        bool first_match_per_file = false;
+        std::optional<std::chrono::steady_clock::time_point> deadline;
+        std::optional<cancellation_token> cancellation;
+        scan_stats *stats = nullptr;
+        scan_cache *cache = nullptr;
+        elf_mode elf = elf_mode::DISABLED;
+        std::vector<std::string_view> elf_sections;
         extension_checking_mode extension_checking = extension_checking_mode::WHITELIST;
         std::vector<std::string_view> extensions;
         filename_checking_mode filename_checking = filename_checking_mode::EXACT;
@@ -169,6 +634,65 @@ namespace sigscanner
 
         friend multi_scanner;
         friend scanner;
+        friend scan_limits;
+        friend directory_walker;
+        friend corpus_index;
+    };
+
+    /*
+     * Records which blocks of every file in a corpus contain each n-gram of SIGSCANNER_INDEX_GRAM_LENGTH
+     * bytes, so multi_scanner::scan_index only reads the blocks containing every n-gram of a signature's
+     * literal runs. Meant for a corpus that is scanned for many different signatures but rarely changes.
+     *
+     * Like scan_cache the file is mapped and searched in place. Each distinct n-gram of each block is a
+     * posting, about 0.8 per byte for executables and at most 1 per byte. The index takes 4 bytes per
+     * posting and 16 per distinct n-gram, about 5 times the size of a corpus of executables.
+     *
+     * Building needs about SIGSCANNER_INDEX_RUN_SIZE of memory per thread whatever the size of the
+     * corpus. Postings are sorted into runs of that size next to the index, 8 bytes per posting, and
+     * merged while it is written, so it needs free disk space of about 3 times the index size until then.
+     */
+    class corpus_index
+    {
+    public:
+        explicit corpus_index(const std::filesystem::path &path); // is_open() is false if path isn't a valid index
+        ~corpus_index();
+        corpus_index(const corpus_index &copy) = delete;
+        corpus_index &operator=(const corpus_index &copy) = delete;
+
+        // Index every file under root that passes the filters in options and write the index to path
+        static bool build(const std::filesystem::path &root, const std::filesystem::path &path, const scan_options &options = scan_options());
+
+        bool is_open() const;
+        std::size_t file_count() const;
+
+    private:
+        struct header;
+        struct file_record;
+        struct gram_record;
+
+        struct file_ranges
+        {
+            std::filesystem::path path;
+            std::uint64_t size;
+            bool changed; // Since the index was built, so the whole file has to be scanned
+            std::vector<std::pair<std::uint64_t, std::uint64_t>> ranges; // [begin, end) where matches may start, sorted
+        };
+
+        // Every indexed file that still exists, with the parts of it that may contain a match of any of signatures
+        std::vector<file_ranges> ranges(const std::vector<signature> &signatures) const;
+        // Blocks that may contain the start of a match of signature, sorted. Null if every block might
+        std::optional<std::vector<std::uint32_t>> candidate_blocks(const signature &signature) const;
+        std::pair<const std::uint32_t *, const std::uint32_t *> postings(std::uint32_t gram) const;
+
+        std::unique_ptr<const mapped_file> mapping;
+        const header *head = nullptr;
+        const file_record *files = nullptr; // Sorted by first block
+        const gram_record *grams = nullptr; // Sorted by gram
+        const std::uint32_t *posting_blocks = nullptr; // The blocks containing each gram, sorted
+        const char *paths = nullptr;
+
+        friend multi_scanner;
     };
 
     class multi_scanner
@@ -183,29 +707,142 @@ namespace sigscanner
          */
         void add_signature(const signature &signature);
         void add_signatures(const std::vector<signature> &signatures);
+        /*
+         * Build what scanning the signatures needs, which is otherwise built by the first scan after
+         * they change. With SIGSCANNER_AUTOMATON_MIN_SIGNATURES or more that is an automaton.
+         */
+        void prepare() const;
 
         [[nodiscard]] std::unordered_map<signature, std::vector<offset>>
         scan(const byte *data, std::size_t len, const scan_options &options = scan_options()) const;
         [[nodiscard]] std::unordered_map<signature, std::vector<offset>>
         reverse_scan(const byte *data, std::size_t len, const scan_options &options = scan_options()) const;
+        /*
+         * Write up to capacity matches to out on the calling thread and return how many were written,
+         * allocating nothing once prepare() has been called. overflowed is set if there were more, and like
+         * with scan_options::set_max_matches which ones were kept is unspecified.
+         */
+        std::size_t scan(const byte *data, std::size_t len, match *out, std::size_t capacity, bool &overflowed) const;
         [[nodiscard]] std::unordered_map<signature, std::vector<offset>> scan_file(const std::filesystem::path &path, const scan_options &options = scan_options()) const;
         [[nodiscard]] std::unordered_map<signature, std::unordered_map<std::filesystem::path, std::vector<offset>>>
         scan_directory(const std::filesystem::path &path, const scan_options &options = scan_options()) const;
 
+        /*
+         * Deliver matches to sink while scanning instead of collecting them, so memory use doesn't
+         * grow with the number of matches. Returns once every match has been delivered.
+         */
+        void scan_file(const std::filesystem::path &path, const match_sink &sink, const scan_options &options = scan_options()) const;
+        void scan_directory(const std::filesystem::path &path, const match_sink &sink, const scan_options &options = scan_options()) const;
+
+        /*
+         * Scan the files of a corpus_index, reading only the blocks the index can't rule out. Signatures
+         * without a literal run of SIGSCANNER_INDEX_GRAM_LENGTH bytes need every file read whole, as do
+         * files that changed since the index was built. Files added since aren't scanned, and the filters
+         * in options were applied when the index was built instead.
+         */
+        [[nodiscard]] std::unordered_map<signature, std::unordered_map<std::filesystem::path, std::vector<offset>>>
+        scan_index(const corpus_index &index, const scan_options &options = scan_options()) const;
+        void scan_index(const corpus_index &index, const match_sink &sink, const scan_options &options = scan_options()) const;
+
+        /*
+         * Scan something that can only be read once from front to back and whose size isn't known, like
+         * a pipe or a decompressor's output. Blocks are read on the calling thread and scanned by the
+         * workers, each starting with the last bytes of the one before so matches running across them
+         * are found. Reading waits for the workers once max_bytes_in_flight are queued.
+         *
+         * Reading stops at the end, after an error or once a limit is reached. Matches are reported with
+         * an empty path. The file filters, read and threading modes, ELF mode and cache in options don't apply.
+         */
+        [[nodiscard]] std::unordered_map<signature, std::vector<offset>> scan_stream(std::istream &stream, const scan_options &options = scan_options()) const;
+        void scan_stream(std::istream &stream, const match_sink &sink, const scan_options &options = scan_options()) const;
+        // Like scan_stream, reading a file descriptor such as 0 for stdin from wherever it is. It is left open
+        [[nodiscard]] std::unordered_map<signature, std::vector<offset>> scan_fd(int fd, const scan_options &options = scan_options()) const;
+        void scan_fd(int fd, const match_sink &sink, const scan_options &options = scan_options()) const;
+
+        /*
+         * Scan the readable memory of a running process, reporting virtual addresses along with the
+         * region each was found in. Memory is copied out with process_vm_readv while the process keeps
+         * running, which needs the same permission as attaching a debugger. Linux only.
+         *
+         * Regions count as files for scan_stats and set_first_match_per_file. The file filters, read
+         * and threading modes and cache in options don't apply.
+         *
+         * With a sink, returns false if the process doesn't exist, may not be read or exited during the
+         * scan, in which case only the regions read before that were scanned.
+         */
+        [[nodiscard]] std::unordered_map<signature, std::map<process_region, std::vector<offset>>>
+        scan_process(int pid, const scan_options &options = scan_options()) const;
+        bool scan_process(int pid, const region_sink &sink, const scan_options &options = scan_options()) const;
+
+        const std::vector<signature> &get_signatures() const;
+
     private:
         /*
-         * Scan a file for a signature. this->thread_pool must already be initialized.
-         * One of results_ptr or directory_results_ptr must be non-null.
-         * The results map must have all keys initialized.
+         * Scan a single file, every file under a directory that passes the filters in options, or the
+         * files of index if it is set. A single file that isn't a regular file, like a named pipe, is
+         * scanned like a stream. sink may be called from several workers at once unless serialize_sink is set.
+         */
+        void scan_paths(const std::filesystem::path &path, bool directory, const corpus_index *index, const match_sink &sink, bool serialize_sink,
+                        const scan_options &options) const;
+
+        /*
+         * Read blocks until read runs dry and queue them, reporting matches under path. sink may be
+         * called from several workers at once unless serialize_sink is set.
+         */
+        void scan_stream_internal(const std::function<std::uint64_t(byte *data, std::uint64_t size)> &read, const std::filesystem::path &path,
+                                  const match_sink &sink, bool serialize_sink, const scan_options &options) const;
+
+        /*
+         * Scan a file for a signature, queueing the work on tasks.
+         * sink may be called from several workers at once.
          */
         void scan_file_internal(const std::filesystem::path &path, const scan_options &options, std::size_t longest_sig,
-                                std::unordered_map<signature, std::unordered_map<std::filesystem::path, std::vector<offset>>> &results,
-                                std::mutex &result_mutex) const;
+                                const aho_corasick *automaton, thread_pool::task_group &tasks, scan_limits &limits, block_pool &blocks,
+                                stats_shards *stats, const match_sink &sink) const;
+
+        /*
+         * Split a mapped file into SIGSCANNER_MAPPED_RANGE_SIZE ranges and scan them in parallel. If
+         * scan_first is set the first range is scanned on the calling thread instead of queued.
+         */
+        void scan_mapped_file(const std::shared_ptr<const mapped_file> &file, const std::filesystem::path &path, std::size_t longest_sig,
+                              const aho_corasick *automaton, thread_pool::task_group &tasks, scan_limits &limits,
+                              const std::shared_ptr<std::atomic<bool>> &state, stats_shards *stats, const match_sink &sink, bool scan_first) const;
+
+        /*
+         * Split a big file into SIGSCANNER_MAPPED_RANGE_SIZE ranges and queue them as sized tasks, read
+         * from a mapping with read_mode::MMAP and block by block otherwise.
+         */
+        void scan_file_ranges(const std::filesystem::path &path, std::uint64_t file_size, const scan_options &options, std::size_t longest_sig,
+                              const aho_corasick *automaton, thread_pool::task_group &tasks, scan_limits &limits,
+                              const std::shared_ptr<std::atomic<bool>> &state, stats_shards *stats, const match_sink &sink) const;
+
+        /*
+         * Read the headers of a file and queue the parts options.elf_mode selects, in tasks of about
+         * SIGSCANNER_MAPPED_RANGE_SIZE bytes. False if it isn't ELF, in which case nothing was queued.
+         */
+        bool scan_elf_file(const std::filesystem::path &path, const scan_options &options, std::size_t longest_sig,
+                           const aho_corasick *automaton, thread_pool::task_group &tasks, scan_limits &limits,
+                           const std::shared_ptr<std::atomic<bool>> &state, stats_shards *stats, const match_sink &sink) const;
 
     private:
         std::vector<signature> signatures;
         std::size_t longest_sig_length() const;
-        mutable sigscanner::thread_pool thread_pool;
+
+        /*
+         * The pool from the options if one was given, otherwise one owned by the scanner that is kept
+         * between scans. It is only replaced when a scan asks for a different thread count.
+         */
+        std::shared_ptr<thread_pool> get_thread_pool(const scan_options &options) const;
+        mutable std::shared_ptr<thread_pool> owned_pool;
+        mutable std::mutex pool_mutex;
+
+        /*
+         * Built on first use after the signatures change. Null if there are fewer than
+         * SIGSCANNER_AUTOMATON_MIN_SIGNATURES signatures.
+         */
+        std::shared_ptr<const aho_corasick> get_automaton() const;
+        mutable std::shared_ptr<const aho_corasick> automaton;
+        mutable std::mutex automaton_mutex;
     };
 
     class scanner
@@ -215,15 +852,67 @@ namespace sigscanner
 
         [[nodiscard]] std::vector<offset> scan(const byte *data, std::size_t len, const scan_options &options = scan_options()) const;
         [[nodiscard]] std::vector<offset> reverse_scan(const byte *data, std::size_t len, const scan_options &options = scan_options()) const;
+        // Like signature::for_each_match and signature::scan with an output buffer, on the calling thread and allocating nothing
+        template<typename visitor>
+        bool for_each_match(const byte *data, std::size_t len, visitor &&visit) const;
+        std::size_t scan(const byte *data, std::size_t len, offset *out, std::size_t capacity, bool &overflowed) const;
         [[nodiscard]] std::vector<offset> scan_file(const std::filesystem::path &path, const scan_options &options = scan_options()) const;
         [[nodiscard]] std::unordered_map<std::filesystem::path, std::vector<offset>>
         scan_directory(const std::filesystem::path &path, const scan_options &options = scan_options()) const;
+        [[nodiscard]] std::unordered_map<std::filesystem::path, std::vector<offset>> scan_index(const corpus_index &index, const scan_options &options = scan_options()) const;
+        [[nodiscard]] std::map<process_region, std::vector<offset>> scan_process(int pid, const scan_options &options = scan_options()) const;
+        [[nodiscard]] std::vector<offset> scan_stream(std::istream &stream, const scan_options &options = scan_options()) const;
+        [[nodiscard]] std::vector<offset> scan_fd(int fd, const scan_options &options = scan_options()) const;
 
     private:
         sigscanner::multi_scanner multi_scanner;
     };
 }
 
+namespace sigscanner
+{
+    template<typename visitor>
+    bool signature::for_each_match(const byte *data, std::size_t size, offset base, visitor &&visit) const
+    {
+      return this->for_each_match_internal(data, size, base, visit, nullptr);
+    }
+
+    template<typename visitor>
+    bool signature::for_each_match(const byte *data, std::size_t size, offset base, visitor &&visit, std::uint64_t &candidates) const
+    {
+      return this->for_each_match_internal(data, size, base, visit, &candidates);
+    }
+
+    template<typename visitor>
+    bool signature::for_each_match_internal(const byte *data, std::size_t size, offset base, visitor &visit, std::uint64_t *candidates) const
+    {
+      // Found in batches, so the search is set up and called once per batch rather than once per match
+      std::array<std::size_t, 64> positions;
+      for (std::size_t start = 0;;)
+      {
+        const std::size_t found = this->find_matches(data, size, start, positions.data(), positions.size(), candidates);
+        for (std::size_t i = 0; i < found; i++)
+        {
+          if (!visit(base + positions[i]))
+          {
+            return false;
+          }
+        }
+        if (found < positions.size())
+        {
+          return true;
+        }
+        start = positions[found - 1] + 1;
+      }
+    }
+
+    template<typename visitor>
+    bool scanner::for_each_match(const byte *data, std::size_t len, visitor &&visit) const
+    {
+      return this->multi_scanner.get_signatures().front().for_each_match(data, len, 0, visit);
+    }
+}
+
 namespace std
 {
     template<>
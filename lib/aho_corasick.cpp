@@ -0,0 +1,122 @@
+#include "aho_corasick.hpp"
+#include "byte_frequency.hpp"
+#include "kernels.hpp"
+#include <queue>
+#include <limits>
+
+sigscanner::aho_corasick::aho_corasick(const std::vector<sigscanner::signature> &sigs)
+{
+  constexpr std::uint32_t undefined = std::numeric_limits<std::uint32_t>::max();
+  this->transitions.assign(256, undefined);
+  std::vector<std::vector<output>> state_outputs(1);
+
+  for (std::size_t s = 0; s < sigs.size(); s++)
+  {
+    const sigscanner::signature &sig = sigs[s];
+
+    // Longest key possible, then the one made of the rarest bytes
+    std::size_t key_offset = 0;
+    std::size_t key_length = 0;
+    double key_frequency = 0.0;
+    std::size_t run_length = 0;
+    for (std::size_t i = 0; i < sig.length; i++)
+    {
+      run_length = sig.mask[i] == sigscanner::signature::mask_type::BYTE ? run_length + 1 : 0;
+      const std::size_t length = std::min<std::size_t>(run_length, SIGSCANNER_AUTOMATON_KEY_LENGTH);
+      if (length == 0 || length < key_length)
+      {
+        continue;
+      }
+      double frequency = 1.0;
+      for (std::size_t k = i + 1 - length; k <= i; k++)
+      {
+        frequency *= sigscanner::byte_frequency[sig.pattern[k]];
+      }
+      if (length > key_length || frequency < key_frequency)
+      {
+        key_offset = i + 1 - length;
+        key_length = length;
+        key_frequency = frequency;
+      }
+    }
+    if (key_length == 0)
+    {
+      this->unkeyed_signatures.push_back(s);
+      continue;
+    }
+
+    std::uint32_t state = 0;
+    for (std::size_t k = key_offset; k < key_offset + key_length; k++)
+    {
+      const std::size_t edge = state + sig.pattern[k];
+      if (this->transitions[edge] == undefined)
+      {
+        this->transitions[edge] = static_cast<std::uint32_t>(this->transitions.size());
+        this->transitions.resize(this->transitions.size() + 256, undefined);
+        state_outputs.emplace_back();
+      }
+      state = this->transitions[edge];
+    }
+    const std::uint32_t start_delta = static_cast<std::uint32_t>(key_offset + key_length);
+    const std::uint32_t packed_offset = static_cast<std::uint32_t>(this->packed.size());
+    const std::size_t words = sigscanner::kernels::packed_words(sig.length);
+    this->packed.insert(this->packed.end(), sig.packed(), sig.packed() + words);
+    state_outputs[state / 256].push_back({static_cast<std::uint32_t>(s), start_delta, packed_offset, static_cast<std::uint32_t>(sig.length)});
+    this->max_start_delta = std::max<std::size_t>(this->max_start_delta, start_delta);
+  }
+
+  // Breadth first so a state's failure state is always complete before the state itself
+  std::vector<std::uint32_t> failure(state_outputs.size(), 0);
+  std::queue<std::uint32_t> queue;
+  for (std::uint32_t c = 0; c < 256; c++)
+  {
+    std::uint32_t &next = this->transitions[c];
+    if (next == undefined)
+    {
+      next = 0;
+    } else
+    {
+      queue.push(next);
+    }
+  }
+  while (!queue.empty())
+  {
+    const std::uint32_t state = queue.front();
+    queue.pop();
+    const std::uint32_t fail = failure[state / 256];
+    state_outputs[state / 256].insert(state_outputs[state / 256].end(), state_outputs[fail / 256].begin(), state_outputs[fail / 256].end());
+    for (std::uint32_t c = 0; c < 256; c++)
+    {
+      std::uint32_t &next = this->transitions[state + c];
+      if (next == undefined)
+      {
+        next = this->transitions[fail + c];
+      } else
+      {
+        failure[next / 256] = this->transitions[fail + c];
+        queue.push(next);
+      }
+    }
+  }
+
+  this->output_index.reserve(state_outputs.size() + 1);
+  for (const auto &state_output: state_outputs)
+  {
+    this->output_index.push_back(static_cast<std::uint32_t>(this->outputs.size()));
+    this->outputs.insert(this->outputs.end(), state_output.begin(), state_output.end());
+  }
+  this->output_index.push_back(static_cast<std::uint32_t>(this->outputs.size()));
+
+  for (std::uint32_t &next: this->transitions)
+  {
+    if (!state_outputs[next / 256].empty())
+    {
+      next |= has_output;
+    }
+  }
+}
+
+const std::vector<std::size_t> &sigscanner::aho_corasick::unkeyed() const
+{
+  return this->unkeyed_signatures;
+}
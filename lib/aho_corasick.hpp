@@ -0,0 +1,97 @@
+#pragma once
+
+#include "sigscanner/sigscanner.hpp"
+#include "kernels.hpp"
+
+namespace sigscanner
+{
+    /*
+     * Finds matches for many signatures in a single pass. Each signature contributes its rarest run of
+     * up to SIGSCANNER_AUTOMATON_KEY_LENGTH BYTEs as a key, and every key hit is verified against the
+     * full signature. Signatures without any BYTEs can't be keyed and have to be scanned on their own.
+     *
+     * Signatures are reported by their index in the vector the automaton was built from, so it must be
+     * rebuilt if they change.
+     */
+    class aho_corasick
+    {
+    public:
+        explicit aho_corasick(const std::vector<signature> &signatures);
+
+        /*
+         * Calls on_match(signature index, position) for every match starting before owned_size that
+         * fits inside size. Matches of one signature are reported in ascending order. If counts is set,
+         * every key hit that is verified is counted into counts[signature index].
+         */
+        template<typename F>
+        void scan(const byte *data, std::size_t size, std::size_t owned_size, F &&on_match, scan_stats::signature_counts *counts = nullptr) const;
+
+        const std::vector<std::size_t> &unkeyed() const;
+
+    private:
+        struct output
+        {
+            std::uint32_t signature;
+            std::uint32_t start_delta; // Key end - signature start
+            std::uint32_t packed_offset; // Into packed
+            std::uint32_t length;
+        };
+
+        // Flag in a transition marking that the target state has outputs
+        static constexpr std::uint32_t has_output = 0x80000000u;
+
+        // transitions[state + byte] is the next state. States are stored pre-multiplied by 256
+        std::vector<std::uint32_t> transitions;
+        // Outputs of state s are outputs[output_index[s / 256]] to outputs[output_index[s / 256 + 1]]
+        std::vector<std::uint32_t> output_index;
+        std::vector<output> outputs;
+        // Every keyed signature's packed pattern back to back, so verifying doesn't have to visit the signatures
+        std::vector<std::uint64_t> packed;
+        std::vector<std::size_t> unkeyed_signatures;
+        std::size_t max_start_delta = 0;
+    };
+
+    template<typename F>
+    void aho_corasick::scan(const byte *data, std::size_t size, std::size_t owned_size, F &&on_match, scan_stats::signature_counts *counts) const
+    {
+      if (this->outputs.empty())
+      {
+        return;
+      }
+      // Nothing starting in the owned part can end a key past this point
+      const std::size_t limit = std::min(size, owned_size + this->max_start_delta - 1);
+      std::uint32_t state = 0;
+      for (std::size_t i = 0; i < limit; i++)
+      {
+        state = this->transitions[(state & ~has_output) + data[i]];
+        if (!(state & has_output))
+        {
+          continue;
+        }
+        const std::uint32_t index = (state & ~has_output) / 256;
+        for (std::uint32_t o = this->output_index[index]; o < this->output_index[index + 1]; o++)
+        {
+          const output &out = this->outputs[o];
+          if (i + 1 < out.start_delta)
+          {
+            continue;
+          }
+          const std::size_t pos = i + 1 - out.start_delta;
+          if (pos >= owned_size || pos + out.length > size)
+          {
+            continue;
+          }
+          const bool matched = kernels::verify_packed(this->packed.data() + out.packed_offset, out.length, data + pos);
+          if (counts != nullptr)
+          {
+            counts[out.signature].candidates++;
+            counts[out.signature].verified += matched;
+          }
+          if (matched)
+          {
+            on_match(static_cast<std::size_t>(out.signature), pos);
+          }
+        }
+      }
+    }
+}
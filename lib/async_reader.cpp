@@ -0,0 +1,414 @@
+#include "async_reader.hpp"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#endif
+
+#ifdef __linux__
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#endif
+
+#ifndef _WIN32
+
+namespace
+{
+    constexpr std::size_t buffer_alignment = 4096;
+    constexpr std::size_t buffer_size = (SIGSCANNER_FILE_BLOCK_SIZE + buffer_alignment - 1) / buffer_alignment * buffer_alignment;
+
+    /*
+     * pread until size bytes are read or the file ends. Returns the number of bytes read or -1.
+     */
+    std::int64_t read_fully(int fd, sigscanner::byte *buffer, std::uint64_t size, std::uint64_t offset)
+    {
+      std::uint64_t total = 0;
+      while (total < size)
+      {
+        const ssize_t result = pread(fd, buffer + total, static_cast<std::size_t>(size - total), static_cast<off_t>(offset + total));
+        if (result < 0)
+        {
+          if (errno == EINTR)
+          {
+            continue;
+          }
+          return -1;
+        }
+        if (result == 0)
+        {
+          break;
+        }
+        total += static_cast<std::uint64_t>(result);
+      }
+      return static_cast<std::int64_t>(total);
+    }
+}
+
+#ifdef __linux__
+/*
+ * A minimal io_uring, set up with raw syscalls so there is no dependency on liburing. Only this
+ * thread submits and reaps, so the ring indices just need acquire/release ordering against the kernel.
+ */
+struct sigscanner::async_reader::ring
+{
+    int fd = -1;
+    void *sq_map = nullptr;
+    std::size_t sq_map_size = 0;
+    void *cq_map = nullptr;
+    std::size_t cq_map_size = 0;
+    io_uring_sqe *sqes = nullptr;
+    std::size_t sqes_size = 0;
+
+    unsigned *sq_tail = nullptr;
+    unsigned *sq_mask = nullptr;
+    unsigned *sq_array = nullptr;
+    unsigned *cq_head = nullptr;
+    unsigned *cq_tail = nullptr;
+    unsigned *cq_mask = nullptr;
+    io_uring_cqe *cqes = nullptr;
+    bool fixed_buffers = false;
+    unsigned pending_submit = 0;
+
+    ~ring()
+    {
+      if (this->sqes != nullptr)
+        munmap(this->sqes, this->sqes_size);
+      if (this->cq_map != nullptr && this->cq_map != this->sq_map)
+        munmap(this->cq_map, this->cq_map_size);
+      if (this->sq_map != nullptr)
+        munmap(this->sq_map, this->sq_map_size);
+      if (this->fd >= 0)
+        close(this->fd);
+    }
+
+    bool setup(const std::vector<sigscanner::byte *> &buffers)
+    {
+      io_uring_params params{};
+      this->fd = static_cast<int>(syscall(__NR_io_uring_setup, static_cast<unsigned>(buffers.size()), &params));
+      if (this->fd < 0)
+      {
+        return false;
+      }
+
+      this->sq_map_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+      this->cq_map_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+      const bool single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+      if (single_mmap)
+      {
+        this->sq_map_size = this->cq_map_size = std::max(this->sq_map_size, this->cq_map_size);
+      }
+      this->sq_map = mmap(nullptr, this->sq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, this->fd, IORING_OFF_SQ_RING);
+      if (this->sq_map == MAP_FAILED)
+      {
+        this->sq_map = nullptr;
+        return false;
+      }
+      if (single_mmap)
+      {
+        this->cq_map = this->sq_map;
+      } else
+      {
+        this->cq_map = mmap(nullptr, this->cq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, this->fd, IORING_OFF_CQ_RING);
+        if (this->cq_map == MAP_FAILED)
+        {
+          this->cq_map = nullptr;
+          return false;
+        }
+      }
+      this->sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+      void *sqes_map = mmap(nullptr, this->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, this->fd, IORING_OFF_SQES);
+      if (sqes_map == MAP_FAILED)
+      {
+        return false;
+      }
+      this->sqes = static_cast<io_uring_sqe *>(sqes_map);
+
+      auto *sq = static_cast<char *>(this->sq_map);
+      auto *cq = static_cast<char *>(this->cq_map);
+      this->sq_tail = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+      this->sq_mask = reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+      this->sq_array = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+      this->cq_head = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+      this->cq_tail = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+      this->cq_mask = reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+      this->cqes = reinterpret_cast<io_uring_cqe *>(cq + params.cq_off.cqes);
+
+      // Registered buffers skip pinning pages on every read. Fails if RLIMIT_MEMLOCK is too low, plain reads still work
+      std::vector<iovec> iovecs;
+      for (sigscanner::byte *buffer: buffers)
+      {
+        iovecs.push_back({buffer, buffer_size});
+      }
+      this->fixed_buffers = syscall(__NR_io_uring_register, this->fd, IORING_REGISTER_BUFFERS, iovecs.data(), static_cast<unsigned>(iovecs.size())) == 0;
+      return true;
+    }
+
+    void queue_read(int file, sigscanner::byte *buffer, unsigned buffer_index, std::uint64_t size, std::uint64_t offset)
+    {
+      const unsigned tail = *this->sq_tail;
+      const unsigned index = tail & *this->sq_mask;
+      io_uring_sqe &sqe = this->sqes[index];
+      std::memset(&sqe, 0, sizeof(sqe));
+      sqe.opcode = this->fixed_buffers ? IORING_OP_READ_FIXED : IORING_OP_READ;
+      sqe.fd = file;
+      sqe.off = offset;
+      sqe.addr = reinterpret_cast<std::uint64_t>(buffer);
+      sqe.len = static_cast<std::uint32_t>(size);
+      sqe.buf_index = this->fixed_buffers ? static_cast<std::uint16_t>(buffer_index) : 0;
+      sqe.user_data = buffer_index;
+      this->sq_array[index] = index;
+      __atomic_store_n(this->sq_tail, tail + 1, __ATOMIC_RELEASE);
+      this->pending_submit++;
+    }
+
+    bool submit()
+    {
+      while (this->pending_submit > 0)
+      {
+        const long result = syscall(__NR_io_uring_enter, this->fd, this->pending_submit, 0, 0, nullptr, 0);
+        if (result < 0)
+        {
+          if (errno == EINTR || errno == EAGAIN)
+            continue;
+          return false;
+        }
+        this->pending_submit -= static_cast<unsigned>(result);
+      }
+      return true;
+    }
+
+    /*
+     * Reap completions into results until the one for buffer_index arrives
+     */
+    bool wait(unsigned buffer_index, std::vector<std::int64_t> &results, std::vector<bool> &complete)
+    {
+      while (!complete[buffer_index])
+      {
+        unsigned head = *this->cq_head;
+        const unsigned tail = __atomic_load_n(this->cq_tail, __ATOMIC_ACQUIRE);
+        if (head == tail)
+        {
+          const long result = syscall(__NR_io_uring_enter, this->fd, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+          if (result < 0 && errno != EINTR)
+          {
+            return false;
+          }
+          continue;
+        }
+        for (; head != tail; head++)
+        {
+          const io_uring_cqe &cqe = this->cqes[head & *this->cq_mask];
+          results[cqe.user_data] = cqe.res;
+          complete[cqe.user_data] = true;
+        }
+        __atomic_store_n(this->cq_head, head, __ATOMIC_RELEASE);
+      }
+      return true;
+    }
+};
+#else
+struct sigscanner::async_reader::ring
+{
+};
+#endif
+
+sigscanner::async_reader::async_reader()
+{
+  for (std::size_t i = 0; i < SIGSCANNER_ASYNC_READ_DEPTH; i++)
+  {
+    void *buffer = nullptr;
+    if (posix_memalign(&buffer, buffer_alignment, buffer_size) != 0)
+    {
+      throw std::bad_alloc();
+    }
+    this->buffers.push_back(static_cast<byte *>(buffer));
+  }
+#ifdef __linux__
+  this->uring = new ring();
+  if (!this->uring->setup(this->buffers))
+  {
+    delete this->uring;
+    this->uring = nullptr;
+  }
+#endif
+}
+
+sigscanner::async_reader::~async_reader()
+{
+  delete this->uring;
+  for (byte *buffer: this->buffers)
+  {
+    std::free(buffer);
+  }
+}
+
+bool sigscanner::async_reader::uses_io_uring() const
+{
+  return this->uring != nullptr;
+}
+
+bool sigscanner::async_reader::read_file(const std::filesystem::path &path, std::size_t overlap, const std::function<bool(std::uint64_t)> &accept_size,
+                                         const block_callback &on_block)
+{
+  const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+  {
+    return false;
+  }
+  struct stat st{};
+  if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode))
+  {
+    close(fd);
+    return false;
+  }
+  const auto file_size = static_cast<std::uint64_t>(st.st_size);
+  if (file_size == 0 || !accept_size(file_size))
+  {
+    close(fd);
+    return true;
+  }
+
+  const std::uint64_t step = SIGSCANNER_FILE_BLOCK_SIZE - overlap;
+#ifdef __linux__
+  if (this->uring != nullptr)
+  {
+    this->read_blocks_uring(fd, file_size, step, on_block);
+  } else
+#endif
+  {
+    this->read_blocks_pread(fd, file_size, step, on_block);
+  }
+  close(fd);
+  return true;
+}
+
+void sigscanner::async_reader::read_blocks_pread(int fd, std::uint64_t file_size, std::uint64_t step, const block_callback &on_block)
+{
+  byte *buffer = this->buffers.front();
+  for (std::uint64_t offset = 0;; offset += step)
+  {
+    std::uint64_t size = std::min(SIGSCANNER_FILE_BLOCK_SIZE, file_size - offset);
+    const std::int64_t read = read_fully(fd, buffer, size, offset);
+    if (read < 0)
+    {
+      return;
+    }
+    bool last = offset + size == file_size;
+    if (static_cast<std::uint64_t>(read) < size)
+    {
+      size = static_cast<std::uint64_t>(read); // File shrunk while reading
+      last = true;
+    }
+    if (!last)
+    {
+      // Let the kernel read the next block while this one is scanned
+      posix_fadvise(fd, static_cast<off_t>(offset + step), static_cast<off_t>(SIGSCANNER_FILE_BLOCK_SIZE), POSIX_FADV_WILLNEED);
+    }
+    if (!on_block(buffer, size, offset, last) || last)
+    {
+      return;
+    }
+  }
+}
+
+#ifdef __linux__
+void sigscanner::async_reader::read_blocks_uring(int fd, std::uint64_t file_size, std::uint64_t step, const block_callback &on_block)
+{
+  const std::uint64_t block_count = file_size <= SIGSCANNER_FILE_BLOCK_SIZE ? 1 : (file_size - SIGSCANNER_FILE_BLOCK_SIZE + step - 1) / step + 1;
+  const auto depth = static_cast<unsigned>(this->buffers.size());
+  std::vector<std::int64_t> results(depth, 0);
+  std::vector<bool> complete(depth, false);
+  std::uint64_t queued = 0;
+  const auto block_size = [file_size, step](std::uint64_t block) {
+      return std::min(SIGSCANNER_FILE_BLOCK_SIZE, file_size - block * step);
+  };
+  const auto queue_block = [&](std::uint64_t block) {
+      const auto slot = static_cast<unsigned>(block % depth);
+      complete[slot] = false;
+      this->uring->queue_read(fd, this->buffers[slot], slot, block_size(block), block * step);
+  };
+
+  for (; queued < block_count && queued < depth; queued++)
+  {
+    queue_block(queued);
+  }
+  bool success = this->uring->submit();
+
+  // Block b is read into buffer b % depth, so the depth - 1 blocks after the one being scanned are in flight
+  std::uint64_t block = 0;
+  for (; success && block < block_count; block++)
+  {
+    const auto slot = static_cast<unsigned>(block % depth);
+    if (!this->uring->wait(slot, results, complete))
+    {
+      success = false;
+      break;
+    }
+    std::uint64_t size = block_size(block);
+    std::int64_t read = results[slot];
+    if (read == -EINVAL || read == -EOPNOTSUPP || (read >= 0 && static_cast<std::uint64_t>(read) < size))
+    {
+      // Kernel without this opcode, or a short read. Finish the block synchronously
+      const std::uint64_t done = read > 0 ? static_cast<std::uint64_t>(read) : 0;
+      const std::int64_t rest = read_fully(fd, this->buffers[slot] + done, size - done, block * step + done);
+      read = rest < 0 ? rest : static_cast<std::int64_t>(done) + rest;
+    }
+    if (read < 0)
+    {
+      success = false;
+      break;
+    }
+    bool last = block + 1 == block_count;
+    if (static_cast<std::uint64_t>(read) < size)
+    {
+      size = static_cast<std::uint64_t>(read); // File shrunk while reading
+      last = true;
+    }
+
+    if (!on_block(this->buffers[slot], size, block * step, last) || last)
+    {
+      block++;
+      break;
+    }
+    if (queued < block_count)
+    {
+      queue_block(queued++);
+      success = this->uring->submit();
+    }
+  }
+
+  // Reads still in flight target our buffers, wait for them before the buffers or fd are reused
+  for (std::uint64_t pending = block; pending < queued; pending++)
+  {
+    this->uring->wait(static_cast<unsigned>(pending % depth), results, complete);
+  }
+}
+#endif
+
+#else
+
+struct sigscanner::async_reader::ring
+{
+};
+
+sigscanner::async_reader::async_reader() = default;
+
+sigscanner::async_reader::~async_reader() = default;
+
+bool sigscanner::async_reader::uses_io_uring() const
+{
+  return false;
+}
+
+bool sigscanner::async_reader::read_file(const std::filesystem::path &, std::size_t, const std::function<bool(std::uint64_t)> &, const block_callback &)
+{
+  return false; // Callers read the file with std::fstream instead
+}
+
+#endif
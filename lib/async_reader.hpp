@@ -0,0 +1,48 @@
+#pragma once
+
+#include "sigscanner/sigscanner.hpp"
+
+namespace sigscanner
+{
+    /*
+     * Reads files in overlapping blocks while keeping up to SIGSCANNER_ASYNC_READ_DEPTH reads in
+     * flight, so a block can be scanned while the following ones are still being read. Uses io_uring
+     * with registered buffers where the kernel allows it, otherwise pread with readahead hints.
+     *
+     * Setting up a ring is expensive, so each worker thread should keep one reader for every file it scans.
+     */
+    class async_reader
+    {
+    public:
+        async_reader();
+        ~async_reader();
+        async_reader(const async_reader &copy) = delete;
+        async_reader &operator=(const async_reader &copy) = delete;
+
+        /*
+         * Called for each block in file order. The data is only valid until the callback returns.
+         * Returning false stops reading the file.
+         */
+        typedef std::function<bool(const byte *data, std::uint64_t size, std::uint64_t offset, bool last)> block_callback;
+
+        /*
+         * Read the whole file in SIGSCANNER_FILE_BLOCK_SIZE blocks, each overlapping the previous one
+         * by overlap bytes. Nothing is read if accept_size returns false for the file's size.
+         * Returns false if the file couldn't be opened as a regular file, in which case nothing was read.
+         * A read error part way through stops at the last complete block.
+         */
+        bool read_file(const std::filesystem::path &path, std::size_t overlap, const std::function<bool(std::uint64_t size)> &accept_size,
+                       const block_callback &on_block);
+
+        bool uses_io_uring() const;
+
+    private:
+        struct ring;
+
+        void read_blocks_uring(int fd, std::uint64_t file_size, std::uint64_t step, const block_callback &on_block);
+        void read_blocks_pread(int fd, std::uint64_t file_size, std::uint64_t step, const block_callback &on_block);
+
+        std::vector<byte *> buffers;
+        ring *uring = nullptr;
+    };
+}
@@ -0,0 +1,44 @@
+#include "block_pool.hpp"
+#include <algorithm>
+
+namespace
+{
+    constexpr std::align_val_t block_alignment = std::align_val_t(4096);
+}
+
+sigscanner::block_pool::block_pool(std::uint64_t max_bytes)
+        : max_blocks(static_cast<std::size_t>(std::max<std::uint64_t>(max_bytes / SIGSCANNER_FILE_BLOCK_SIZE, 1)))
+{
+}
+
+sigscanner::block_pool::~block_pool()
+{
+  for (sigscanner::byte *block: this->blocks)
+  {
+    ::operator delete(block, block_alignment);
+  }
+}
+
+sigscanner::byte *sigscanner::block_pool::try_acquire()
+{
+  std::lock_guard<std::mutex> lock(this->mutex);
+  if (!this->free_blocks.empty())
+  {
+    sigscanner::byte *block = this->free_blocks.back();
+    this->free_blocks.pop_back();
+    return block;
+  }
+  if (this->blocks.size() < this->max_blocks)
+  {
+    auto *block = static_cast<sigscanner::byte *>(::operator new(SIGSCANNER_FILE_BLOCK_SIZE, block_alignment));
+    this->blocks.push_back(block);
+    return block;
+  }
+  return nullptr;
+}
+
+void sigscanner::block_pool::release(sigscanner::byte *block)
+{
+  std::lock_guard<std::mutex> lock(this->mutex);
+  this->free_blocks.push_back(block);
+}
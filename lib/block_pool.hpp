@@ -0,0 +1,34 @@
+#pragma once
+
+#include "sigscanner/sigscanner.hpp"
+
+namespace sigscanner
+{
+    /*
+     * Page aligned SIGSCANNER_FILE_BLOCK_SIZE buffers for chunks waiting to be scanned. Blocks are
+     * allocated as they are first needed and recycled after that, and no more than max_bytes worth
+     * are handed out at once, so reading a file can't run further ahead of the scan than that.
+     */
+    class block_pool
+    {
+    public:
+        explicit block_pool(std::uint64_t max_bytes); // Always allows at least one block
+        ~block_pool();
+        block_pool(const block_pool &copy) = delete;
+        block_pool &operator=(const block_pool &copy) = delete;
+
+        /*
+         * Null if every block is in use. Waiting for one to come back could deadlock a pool whose
+         * workers are all reading, and running queued tasks meanwhile nests without bound, so callers
+         * scan the chunk themselves instead.
+         */
+        byte *try_acquire();
+        void release(byte *block);
+
+    private:
+        const std::size_t max_blocks;
+        std::vector<byte *> blocks; // Every block allocated, freed with the pool
+        std::vector<byte *> free_blocks;
+        std::mutex mutex;
+    };
+}
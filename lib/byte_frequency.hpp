@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstdint>
+
+namespace sigscanner
+{
+    /*
+     * How often each byte value appears in machine code, per 65536 bytes. Half comes from the .text
+     * sections of a Debian x86-64 userland, half is an estimate for AArch64 where every fourth byte
+     * is an opcode byte. Only the relative order matters, it is used to pick rare anchor bytes.
+     */
+    constexpr std::uint16_t byte_frequency[256] = {
+        5641, 1218,  676, 1045,  586,  216,  122,  132,  693,  111,  158,   92,  129,  103,   81, 1212, // 00
+         660,  283,  218,  358,  388,  255,  221,  207,  214,   73,  135,   69,   91,   76,  138,  844, // 10
+         642,  364,   68,   68, 1031,  112,   65,   66,  220,  137,  198,   82,   86,   74,  122,  135, // 20
+         159,  256,   65,   71,  220,  237,  130,  133,  208,  421,   69,  105,  108,  177,   69,   75, // 30
+         948,  845,  227,  269,  648,  233,   92,  107, 2418,  433,   79,  145,  635,  182,   76,   76, // 40
+         164,   71,  396,  188,  426,  139,   98,  104,  134,   96,   65,  124,  143,  142,  102,  234, // 50
+         393,   69,   98,   90,  116,   71,  410,   66,  104,   70,   71,  202,  105,   71,   77,  109, // 60
+         129,  197,  153,   89,  344,  198,   78,   83,  177,  138,   67,  504,  159,   99,   92,  103, // 70
+         610,  255,  211,  507,  480,  428,   74,   87,  116, 1333,   68, 1140,   93,  534,   73,   68, // 80
+         412,  651,  129,  270,  491,   73,   61,  390,   87,   66,  124,   60,   77,   64,   60,   61, // 90
+         231,   66,   60,   63,   68,   61,   60,   60,  154,  454,  590,   63,   78,   61,   63,   73, // A0
+          94,   66,   60,   63,  221,  199,  112,   92,  199,  492,  123,   73,  114,   80,  128,  380, // B0
+         656,  245,  129,  203,  180,  174,  167,  265,  127,  121,   86,   72,   77,   75,   77,   76, // C0
+         130,  228,  191,  151,   74,   78,  215,   78,  119,   84,   83,  103,   71,   78,   92,  143, // D0
+         982,  517,  384,  362,   87,   84,   95,  111,  594,  269,   97,  375,  113,  111,  112,  153, // E0
+         137,  286,  188,  415,   78,   97,  169,  139,  241,  904,  128,  122,  119,  654,  261, 1464, // F0
+    };
+
+    constexpr std::uint32_t byte_frequency_total = 65536;
+}
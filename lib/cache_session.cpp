@@ -0,0 +1,56 @@
+#include "cache_session.hpp"
+#include <algorithm>
+
+sigscanner::cache_session::cache_session(sigscanner::scan_cache &cache, const std::vector<sigscanner::signature> &signatures)
+        : cache(cache), signature_count(signatures.size()), signature_set(sigscanner::scan_cache::hash_signatures(signatures))
+{
+}
+
+bool sigscanner::cache_session::lookup(const std::filesystem::path &path, std::vector<sigscanner::match> &matches)
+{
+  const std::optional<sigscanner::scan_cache::key> key = sigscanner::scan_cache::identify(path, this->signature_set);
+  if (!key)
+  {
+    return false;
+  }
+  if (this->cache.find(*key, matches) && std::all_of(matches.begin(), matches.end(), [this](const sigscanner::match &match) {
+      return match.signature < this->signature_count;
+  }))
+  {
+    return true;
+  }
+  std::lock_guard<std::mutex> lock(this->files_mutex);
+  this->files[path] = {*key, {}};
+  return false;
+}
+
+void sigscanner::cache_session::record(const std::filesystem::path &path, const std::vector<sigscanner::match> &matches)
+{
+  std::lock_guard<std::mutex> lock(this->files_mutex);
+  const auto file = this->files.find(path);
+  if (file != this->files.end())
+  {
+    file->second.matches.insert(file->second.matches.end(), matches.begin(), matches.end());
+  }
+}
+
+void sigscanner::cache_session::finish(sigscanner::scan_limits &limits, bool first_match_per_file)
+{
+  if (limits.stopped())
+  {
+    return;
+  }
+  for (auto &[path, file]: this->files)
+  {
+    if (first_match_per_file && !file.matches.empty())
+    {
+      continue;
+    }
+    // Chunks are recorded in whatever order they were scanned
+    std::sort(file.matches.begin(), file.matches.end(), [](const sigscanner::match &a, const sigscanner::match &b) {
+        return a.signature != b.signature ? a.signature < b.signature : a.offset < b.offset;
+    });
+    this->cache.add(file.key, std::move(file.matches));
+  }
+  this->files.clear();
+}
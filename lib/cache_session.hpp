@@ -0,0 +1,45 @@
+#pragma once
+
+#include "sigscanner/sigscanner.hpp"
+#include "scan_limits.hpp"
+
+namespace sigscanner
+{
+    /*
+     * One scan's use of a scan_cache. Files with cached results are answered from it, the others are
+     * remembered along with the matches found in them and added to the cache once the scan is done.
+     */
+    class cache_session
+    {
+    public:
+        cache_session(scan_cache &cache, const std::vector<signature> &signatures);
+        cache_session(const cache_session &copy) = delete;
+        cache_session &operator=(const cache_session &copy) = delete;
+
+        /*
+         * Copies the cached results of path into matches. If there are none the file is remembered, so
+         * what record() is given for it can be added later. Safe to call from any number of threads at once
+         */
+        bool lookup(const std::filesystem::path &path, std::vector<match> &matches);
+        void record(const std::filesystem::path &path, const std::vector<match> &matches); // Same here
+
+        /*
+         * Add the files that weren't cached. Nothing is added if the scan stopped early, and with
+         * first_match_per_file only files without a match were scanned to the end.
+         */
+        void finish(scan_limits &limits, bool first_match_per_file);
+
+    private:
+        struct pending_file
+        {
+            scan_cache::key key;
+            std::vector<match> matches;
+        };
+
+        scan_cache &cache;
+        const std::size_t signature_count;
+        const std::uint64_t signature_set;
+        std::mutex files_mutex;
+        std::unordered_map<std::filesystem::path, pending_file> files;
+    };
+}
@@ -0,0 +1,15 @@
+#include "sigscanner/sigscanner.hpp"
+
+sigscanner::cancellation_token::cancellation_token() : cancelled(std::make_shared<std::atomic<bool>>(false))
+{
+}
+
+void sigscanner::cancellation_token::cancel()
+{
+  this->cancelled->store(true, std::memory_order_relaxed);
+}
+
+bool sigscanner::cancellation_token::is_cancelled() const
+{
+  return this->cancelled->load(std::memory_order_relaxed);
+}
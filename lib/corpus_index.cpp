@@ -0,0 +1,689 @@
+#include "sigscanner/sigscanner.hpp"
+#include "mapped_file.hpp"
+#include "scan_limits.hpp"
+#include "directory_walker.hpp"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <limits>
+#include <random>
+#include <sstream>
+
+/*
+ * The file is a header, the indexed files sorted by their first block, every gram that appears sorted
+ * by value, the blocks of each gram one list after another, and finally the paths of the files.
+ * Blocks are numbered across the whole corpus, each file's from first_block on.
+ */
+struct sigscanner::corpus_index::header
+{
+  std::array<char, 8> magic;
+  std::uint32_t version;
+  std::uint32_t byte_order; // Written natively, so indexes from a machine of the other byte order aren't loaded
+  std::uint32_t gram_length; // The SIGSCANNER_INDEX_GRAM_LENGTH and SIGSCANNER_INDEX_BLOCK_SIZE the index was built with
+  std::uint32_t reserved;
+  std::uint64_t block_size;
+  std::uint64_t file_count;
+  std::uint64_t block_count;
+  std::uint64_t gram_count;
+  std::uint64_t posting_count;
+  std::uint64_t path_bytes;
+};
+
+struct sigscanner::corpus_index::file_record
+{
+  std::uint64_t first_block;
+  std::uint64_t size;
+  std::int64_t modified; // std::filesystem::last_write_time when it was indexed
+  std::uint64_t path_offset; // UTF-8
+  std::uint64_t path_length;
+};
+
+struct sigscanner::corpus_index::gram_record
+{
+  std::uint32_t gram;
+  std::uint32_t reserved;
+  std::uint64_t first_posting; // Its blocks end where the next gram's start
+};
+
+namespace
+{
+  constexpr std::array<char, 8> index_magic = {'S', 'I', 'G', 'I', 'N', 'D', 'E', 'X'};
+  constexpr std::uint32_t index_version = 1;
+  constexpr std::uint32_t index_byte_order = 0x01020304;
+
+  static_assert(SIGSCANNER_INDEX_GRAM_LENGTH >= 1 && SIGSCANNER_INDEX_GRAM_LENGTH <= 4, "Grams are stored in 32 bits");
+  static_assert(SIGSCANNER_INDEX_BLOCK_SIZE >= SIGSCANNER_INDEX_GRAM_LENGTH, "A block has to hold a gram");
+
+  std::uint32_t read_gram(const sigscanner::byte *data, std::size_t length)
+  {
+    std::uint32_t gram = 0;
+    std::memcpy(&gram, data, length);
+    return gram;
+  }
+
+  /*
+   * Sort and deduplicate a block's grams 16 bits at a time. A block has hundreds of thousands of them,
+   * where this is several times faster than std::sort.
+   */
+  void sort_grams(std::vector<std::uint32_t> &grams, std::vector<std::uint32_t> &scratch)
+  {
+    thread_local std::vector<std::uint32_t> counts;
+    counts.resize(65536 + 1);
+    scratch.resize(grams.size());
+    for (const int shift: {0, 16})
+    {
+      std::fill(counts.begin(), counts.end(), 0);
+      for (const std::uint32_t gram: grams)
+      {
+        counts[((gram >> shift) & 0xffff) + 1]++;
+      }
+      for (std::size_t i = 1; i < counts.size(); i++)
+      {
+        counts[i] += counts[i - 1];
+      }
+      for (const std::uint32_t gram: grams)
+      {
+        scratch[counts[(gram >> shift) & 0xffff]++] = gram;
+      }
+      grams.swap(scratch);
+    }
+    grams.erase(std::unique(grams.begin(), grams.end()), grams.end());
+  }
+
+  /*
+   * Postings sorted a buffer at a time into run files next to the index, which merge() then reads back
+   * in order. Each task fills a buffer of its own, so building holds about one SIGSCANNER_INDEX_RUN_SIZE
+   * buffer per thread however big the corpus is, and the lock is only taken to hand them out.
+   */
+  class posting_runs
+  {
+  public:
+      static constexpr std::size_t run_postings = std::max<std::size_t>(SIGSCANNER_INDEX_RUN_SIZE / sizeof(std::uint64_t), SIGSCANNER_INDEX_BLOCK_SIZE);
+
+      explicit posting_runs(std::filesystem::path prefix) : prefix(std::move(prefix))
+      {}
+
+      posting_runs(const posting_runs &copy) = delete;
+      posting_runs &operator=(const posting_runs &copy) = delete;
+
+      ~posting_runs()
+      {
+        for (const std::filesystem::path &path: this->paths)
+        {
+          std::error_code error;
+          std::filesystem::remove(path, error);
+        }
+      }
+
+      std::vector<std::uint64_t> take_buffer()
+      {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        if (this->buffers.empty())
+        {
+          std::vector<std::uint64_t> buffer;
+          buffer.reserve(run_postings);
+          return buffer;
+        }
+        std::vector<std::uint64_t> buffer = std::move(this->buffers.back());
+        this->buffers.pop_back();
+        return buffer;
+      }
+
+      // Kept to be filled further by later tasks, until finish()
+      void return_buffer(std::vector<std::uint64_t> buffer)
+      {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->buffers.push_back(std::move(buffer));
+      }
+
+      // Sort buffer into a new run and empty it
+      void write_run(std::vector<std::uint64_t> &buffer)
+      {
+        if (buffer.empty())
+        {
+          return;
+        }
+        std::sort(buffer.begin(), buffer.end());
+        const std::filesystem::path path = this->next_path();
+        std::ofstream out(path, std::ios::out | std::ios::binary | std::ios::trunc);
+        out.write(reinterpret_cast<const char *>(buffer.data()), static_cast<std::streamsize>(buffer.size() * sizeof(std::uint64_t)));
+        out.close();
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->failed |= !out;
+        this->posting_count += buffer.size();
+        buffer.clear();
+      }
+
+      // Write what is left in the buffers once every task is done. False if any run couldn't be written
+      bool finish()
+      {
+        for (std::vector<std::uint64_t> &buffer: this->buffers)
+        {
+          this->write_run(buffer);
+        }
+        this->buffers.clear();
+        return !this->failed;
+      }
+
+      std::uint64_t size() const
+      {
+        return this->posting_count;
+      }
+
+      /*
+       * Call visit with every posting in order. Up to SIGSCANNER_INDEX_MERGE_WIDTH runs are merged at
+       * once, first into longer runs if there are more, so only that many files are open at a time.
+       */
+      template<class Visit>
+      bool merge(Visit &&visit)
+      {
+        while (this->paths.size() > SIGSCANNER_INDEX_MERGE_WIDTH)
+        {
+          const std::vector<std::filesystem::path> merged(this->paths.begin(), this->paths.begin() + SIGSCANNER_INDEX_MERGE_WIDTH);
+          this->paths.erase(this->paths.begin(), this->paths.begin() + SIGSCANNER_INDEX_MERGE_WIDTH);
+          const std::filesystem::path path = this->next_path();
+          std::ofstream out(path, std::ios::out | std::ios::binary | std::ios::trunc);
+          std::vector<std::uint64_t> pending;
+          pending.reserve(read_postings);
+          const bool read = merge_files(merged, [&out, &pending](std::uint64_t posting) {
+              pending.push_back(posting);
+              if (pending.size() == pending.capacity())
+              {
+                out.write(reinterpret_cast<const char *>(pending.data()), static_cast<std::streamsize>(pending.size() * sizeof(std::uint64_t)));
+                pending.clear();
+              }
+          });
+          out.write(reinterpret_cast<const char *>(pending.data()), static_cast<std::streamsize>(pending.size() * sizeof(std::uint64_t)));
+          out.close();
+          for (const std::filesystem::path &merged_path: merged)
+          {
+            std::error_code error;
+            std::filesystem::remove(merged_path, error);
+          }
+          if (!read || !out)
+          {
+            return false;
+          }
+        }
+        return merge_files(this->paths, visit);
+      }
+
+  private:
+      // Postings read from each run at a time while merging, about one run's worth across all of them
+      static constexpr std::size_t read_postings = std::max<std::size_t>(run_postings / SIGSCANNER_INDEX_MERGE_WIDTH, 4096);
+
+      struct run_reader
+      {
+          std::ifstream file;
+          std::vector<std::uint64_t> buffer;
+          std::size_t position = 0;
+
+          bool next(std::uint64_t &posting)
+          {
+            if (this->position == this->buffer.size())
+            {
+              this->buffer.resize(read_postings);
+              this->file.read(reinterpret_cast<char *>(this->buffer.data()), static_cast<std::streamsize>(read_postings * sizeof(std::uint64_t)));
+              this->buffer.resize(static_cast<std::size_t>(this->file.gcount()) / sizeof(std::uint64_t));
+              this->position = 0;
+              if (this->buffer.empty())
+              {
+                return false;
+              }
+            }
+            posting = this->buffer[this->position++];
+            return true;
+          }
+      };
+
+      template<class Visit>
+      static bool merge_files(const std::vector<std::filesystem::path> &paths, Visit &&visit)
+      {
+        std::vector<run_reader> readers(paths.size());
+        // The smallest posting of each run not yet visited, and its run
+        std::vector<std::pair<std::uint64_t, std::size_t>> heads;
+        for (std::size_t i = 0; i < paths.size(); i++)
+        {
+          readers[i].file.open(paths[i], std::ios::in | std::ios::binary);
+          if (!readers[i].file.is_open())
+          {
+            return false;
+          }
+          std::uint64_t posting;
+          if (readers[i].next(posting))
+          {
+            heads.emplace_back(posting, i);
+          }
+        }
+        const auto greater = std::greater<std::pair<std::uint64_t, std::size_t>>();
+        std::make_heap(heads.begin(), heads.end(), greater);
+        while (!heads.empty())
+        {
+          std::pop_heap(heads.begin(), heads.end(), greater);
+          auto &[posting, run] = heads.back();
+          visit(posting);
+          if (readers[run].next(posting))
+          {
+            std::push_heap(heads.begin(), heads.end(), greater);
+          } else
+          {
+            heads.pop_back();
+          }
+        }
+        return true;
+      }
+
+      std::filesystem::path next_path()
+      {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        std::ostringstream name;
+        name << this->prefix.filename().string() << "-" << this->run_count++;
+        this->paths.push_back(this->prefix.parent_path() / name.str());
+        return this->paths.back();
+      }
+
+      const std::filesystem::path prefix;
+      std::mutex mutex;
+      std::vector<std::vector<std::uint64_t>> buffers; // Returned by tasks, partly filled
+      std::vector<std::filesystem::path> paths; // Runs not merged yet, every one is removed on destruction
+      std::size_t run_count = 0;
+      std::uint64_t posting_count = 0;
+      bool failed = false;
+  };
+
+  /*
+   * Every distinct gram starting in each block of a file, as gram << 32 | block so that sorting all of
+   * them orders them by gram, then block. A block's last grams run into the next block. postings is
+   * written to runs whenever another block might not fit.
+   */
+  void index_file(const std::filesystem::path &path, std::uint64_t size, std::uint64_t first_block, std::vector<std::uint64_t> &postings, posting_runs &runs)
+  {
+    std::fstream file(path, std::ios::in | std::ios::binary);
+    if (!file.is_open())
+    {
+      return;
+    }
+    thread_local std::vector<sigscanner::byte> block;
+    thread_local std::vector<std::uint32_t> grams;
+    thread_local std::vector<std::uint32_t> scratch;
+    block.resize(SIGSCANNER_INDEX_BLOCK_SIZE + SIGSCANNER_INDEX_GRAM_LENGTH - 1);
+    std::uint64_t block_number = first_block;
+    for (std::uint64_t offset = 0; offset < size; offset += SIGSCANNER_INDEX_BLOCK_SIZE, block_number++)
+    {
+      file.seekg(static_cast<std::streamoff>(offset));
+      file.read(reinterpret_cast<char *>(block.data()), static_cast<std::streamsize>(std::min<std::uint64_t>(block.size(), size - offset)));
+      const auto read = static_cast<std::size_t>(file.gcount());
+      if (read < SIGSCANNER_INDEX_GRAM_LENGTH)
+      {
+        break; // Shrunk since it was sized, or only the end of a gram is left
+      }
+      const std::size_t starts = std::min<std::size_t>(SIGSCANNER_INDEX_BLOCK_SIZE, read - SIGSCANNER_INDEX_GRAM_LENGTH + 1);
+      grams.resize(starts);
+      for (std::size_t i = 0; i < starts; i++)
+      {
+        grams[i] = read_gram(block.data() + i, SIGSCANNER_INDEX_GRAM_LENGTH);
+      }
+      sort_grams(grams, scratch);
+      if (postings.size() + grams.size() > posting_runs::run_postings)
+      {
+        runs.write_run(postings);
+      }
+      for (const std::uint32_t gram: grams)
+      {
+        postings.push_back(static_cast<std::uint64_t>(gram) << 32 | block_number);
+      }
+    }
+  }
+}
+
+sigscanner::corpus_index::corpus_index(const std::filesystem::path &path)
+{
+  static_assert(sizeof(header) == 72 && sizeof(file_record) == 40 && sizeof(gram_record) == 16, "Index layout changed, bump index_version");
+  auto mapped = std::make_unique<const sigscanner::mapped_file>(path);
+  if (!mapped->is_open() || mapped->size() < sizeof(header))
+  {
+    return;
+  }
+  const auto *loaded = reinterpret_cast<const header *>(mapped->data());
+  if (loaded->magic != index_magic || loaded->version != index_version || loaded->byte_order != index_byte_order
+      || loaded->gram_length < 1 || loaded->gram_length > 4 || loaded->block_size < loaded->gram_length)
+  {
+    return;
+  }
+  // Each count is checked against what is left before it is multiplied, so corrupt counts can't overflow
+  std::uint64_t available = mapped->size() - sizeof(header);
+  const auto take = [&available](std::uint64_t count, std::uint64_t size) {
+      if (count > available / size)
+      {
+        return false;
+      }
+      available -= count * size;
+      return true;
+  };
+  if (!take(loaded->file_count, sizeof(file_record)) || !take(loaded->gram_count, sizeof(gram_record))
+      || !take(loaded->posting_count, sizeof(std::uint32_t)) || available != loaded->path_bytes)
+  {
+    return;
+  }
+  this->head = loaded;
+  this->files = reinterpret_cast<const file_record *>(loaded + 1);
+  this->grams = reinterpret_cast<const gram_record *>(this->files + loaded->file_count);
+  this->posting_blocks = reinterpret_cast<const std::uint32_t *>(this->grams + loaded->gram_count);
+  this->paths = reinterpret_cast<const char *>(this->posting_blocks + loaded->posting_count);
+  this->mapping = std::move(mapped);
+}
+
+sigscanner::corpus_index::~corpus_index() = default;
+
+bool sigscanner::corpus_index::is_open() const
+{
+  return this->mapping != nullptr;
+}
+
+std::size_t sigscanner::corpus_index::file_count() const
+{
+  return this->head != nullptr ? static_cast<std::size_t>(this->head->file_count) : 0;
+}
+
+bool sigscanner::corpus_index::build(const std::filesystem::path &root, const std::filesystem::path &path, const sigscanner::scan_options &options)
+{
+  struct indexed_file
+  {
+      std::string path;
+      std::uint64_t size;
+      std::int64_t modified;
+      std::uint64_t first_block;
+  };
+
+  const std::shared_ptr<sigscanner::thread_pool> pool = options.pool ? options.pool
+                                                                      : std::make_shared<sigscanner::thread_pool>(std::max<std::size_t>(options.thread_count, 1));
+  sigscanner::scan_limits limits(options);
+  sigscanner::thread_pool::task_group tasks(*pool);
+  std::mutex mutex;
+  std::vector<indexed_file> files; // In order of their first block
+  std::uint64_t block_count = 0;
+  // Written next to the index and renamed over it, like scan_cache::save. The runs go next to it too
+  std::ostringstream temp_name;
+  temp_name << path.filename().string() << ".tmp-" << std::hex << std::random_device{}() << std::random_device{}();
+  const std::filesystem::path temp_path = path.parent_path() / temp_name.str();
+  posting_runs runs(path.parent_path() / (temp_name.str() + ".run"));
+  const auto add_file = [&](const std::filesystem::path &file_path, std::uint64_t file_size) {
+      std::error_code error;
+      const std::filesystem::file_time_type modified = std::filesystem::last_write_time(file_path, error);
+      if (error || file_size == 0 || !options.check_file_size(static_cast<std::int64_t>(file_size)))
+      {
+        return;
+      }
+      std::uint64_t first_block;
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        first_block = block_count;
+        block_count += (file_size + SIGSCANNER_INDEX_BLOCK_SIZE - 1) / SIGSCANNER_INDEX_BLOCK_SIZE;
+        files.push_back({file_path.u8string(), file_size, static_cast<std::int64_t>(modified.time_since_epoch().count()), first_block});
+      }
+      tasks.add_task([file_path, file_size, first_block, &runs] {
+          std::vector<std::uint64_t> postings = runs.take_buffer();
+          index_file(file_path, file_size, first_block, postings, runs);
+          runs.return_buffer(std::move(postings));
+      });
+  };
+  // Outlives the walk, subdirectories are read by tasks
+  sigscanner::directory_walker walker(options, tasks, limits, add_file);
+  if (std::filesystem::is_regular_file(root))
+  {
+    std::error_code error;
+    const std::uint64_t size = std::filesystem::file_size(root, error);
+    if (!error)
+    {
+      add_file(root, size);
+    }
+  } else if (std::filesystem::is_directory(root))
+  {
+    walker.walk(root);
+  } else
+  {
+    return false;
+  }
+  tasks.wait();
+  // Blocks are stored in 32 bits
+  if (!runs.finish() || limits.stopped() || block_count > std::numeric_limits<std::uint32_t>::max())
+  {
+    return false;
+  }
+
+  header head{index_magic, index_version, index_byte_order, SIGSCANNER_INDEX_GRAM_LENGTH, 0, SIGSCANNER_INDEX_BLOCK_SIZE, files.size(), block_count, 0, runs.size(), 0};
+  for (const indexed_file &file: files)
+  {
+    head.path_bytes += file.path.size();
+  }
+
+  /*
+   * The grams come before their blocks but both come out of the one merge, so the blocks are written
+   * to a file of their own and copied in after. The header is rewritten once the grams are counted.
+   */
+  const std::filesystem::path blocks_path = path.parent_path() / (temp_name.str() + ".blocks");
+  const auto remove_temp = [&temp_path, &blocks_path] {
+      std::error_code error;
+      std::filesystem::remove(temp_path, error);
+      std::filesystem::remove(blocks_path, error);
+  };
+  {
+    std::ofstream out(temp_path, std::ios::out | std::ios::binary | std::ios::trunc);
+    out.write(reinterpret_cast<const char *>(&head), sizeof(head));
+    std::uint64_t path_offset = 0;
+    for (const indexed_file &file: files)
+    {
+      const file_record record{file.first_block, file.size, file.modified, path_offset, file.path.size()};
+      out.write(reinterpret_cast<const char *>(&record), sizeof(record));
+      path_offset += file.path.size();
+    }
+    std::ofstream blocks_out(blocks_path, std::ios::out | std::ios::binary | std::ios::trunc);
+    std::vector<gram_record> gram_records;
+    std::vector<std::uint32_t> blocks;
+    constexpr std::size_t write_size = 65536;
+    gram_records.reserve(write_size);
+    blocks.reserve(write_size);
+    std::uint64_t posting_index = 0;
+    std::uint32_t last_gram = 0;
+    const bool merged = runs.merge([&](std::uint64_t posting) {
+        const auto gram = static_cast<std::uint32_t>(posting >> 32);
+        if (posting_index == 0 || gram != last_gram)
+        {
+          last_gram = gram;
+          if (gram_records.size() == write_size)
+          {
+            out.write(reinterpret_cast<const char *>(gram_records.data()), static_cast<std::streamsize>(gram_records.size() * sizeof(gram_record)));
+            gram_records.clear();
+          }
+          gram_records.push_back({gram, 0, posting_index});
+          head.gram_count++;
+        }
+        blocks.push_back(static_cast<std::uint32_t>(posting)); // The low half, the block
+        if (blocks.size() == write_size)
+        {
+          blocks_out.write(reinterpret_cast<const char *>(blocks.data()), static_cast<std::streamsize>(blocks.size() * sizeof(std::uint32_t)));
+          blocks.clear();
+        }
+        posting_index++;
+    });
+    out.write(reinterpret_cast<const char *>(gram_records.data()), static_cast<std::streamsize>(gram_records.size() * sizeof(gram_record)));
+    blocks_out.write(reinterpret_cast<const char *>(blocks.data()), static_cast<std::streamsize>(blocks.size() * sizeof(std::uint32_t)));
+    blocks_out.close();
+    if (head.posting_count != 0)
+    {
+      std::ifstream blocks_in(blocks_path, std::ios::in | std::ios::binary);
+      out << blocks_in.rdbuf();
+    }
+    for (const indexed_file &file: files)
+    {
+      out.write(file.path.data(), static_cast<std::streamsize>(file.path.size()));
+    }
+    out.seekp(0);
+    out.write(reinterpret_cast<const char *>(&head), sizeof(head));
+    out.close();
+    if (!merged || !blocks_out || !out || posting_index != head.posting_count)
+    {
+      remove_temp();
+      return false;
+    }
+  }
+  std::error_code error;
+  std::filesystem::remove(blocks_path, error);
+  std::filesystem::rename(temp_path, path, error);
+  if (error)
+  {
+    std::filesystem::remove(temp_path, error);
+    return false;
+  }
+  return true;
+}
+
+std::pair<const std::uint32_t *, const std::uint32_t *> sigscanner::corpus_index::postings(std::uint32_t gram) const
+{
+  const gram_record *end = this->grams + this->head->gram_count;
+  const gram_record *found = std::lower_bound(this->grams, end, gram, [](const gram_record &record, std::uint32_t value) {
+      return record.gram < value;
+  });
+  if (found == end || found->gram != gram)
+  {
+    return {nullptr, nullptr};
+  }
+  const std::uint64_t first = found->first_posting;
+  const std::uint64_t last = found + 1 != end ? found[1].first_posting : this->head->posting_count;
+  if (first > last || last > this->head->posting_count)
+  {
+    return {nullptr, nullptr};
+  }
+  return {this->posting_blocks + first, this->posting_blocks + last};
+}
+
+std::optional<std::vector<std::uint32_t>> sigscanner::corpus_index::candidate_blocks(const sigscanner::signature &signature) const
+{
+  const auto gram_length = static_cast<std::size_t>(this->head->gram_length);
+  /*
+   * A gram of a match starting in block b starts in b or, as long as the signature is no longer than a
+   * block, in b + 1. Longer ones would have to look further, they are rare enough to just scan everything
+   */
+  if (signature.size() == 0 || signature.size() > this->head->block_size)
+  {
+    return std::nullopt;
+  }
+  std::vector<std::uint32_t> signature_grams;
+  std::size_t run_length = 0;
+  for (std::size_t i = 0; i < signature.size(); i++)
+  {
+    run_length = signature.mask[i] == sigscanner::signature::mask_type::BYTE ? run_length + 1 : 0;
+    if (run_length >= gram_length)
+    {
+      signature_grams.push_back(read_gram(signature.pattern.data() + i + 1 - gram_length, gram_length));
+    }
+  }
+  if (signature_grams.empty())
+  {
+    return std::nullopt;
+  }
+  std::sort(signature_grams.begin(), signature_grams.end());
+  signature_grams.erase(std::unique(signature_grams.begin(), signature_grams.end()), signature_grams.end());
+
+  std::vector<std::pair<const std::uint32_t *, const std::uint32_t *>> lists;
+  for (const std::uint32_t gram: signature_grams)
+  {
+    lists.push_back(this->postings(gram));
+    if (lists.back().first == lists.back().second)
+    {
+      return std::vector<std::uint32_t>(); // Appears nowhere, so neither does the signature
+    }
+  }
+  // Start from the rarest gram so the candidates only shrink from there
+  std::sort(lists.begin(), lists.end(), [](const auto &a, const auto &b) {
+      return a.second - a.first < b.second - b.first;
+  });
+  std::vector<std::uint32_t> blocks;
+  for (const std::uint32_t *block = lists[0].first; block != lists[0].second; block++)
+  {
+    if (*block > 0 && (blocks.empty() || blocks.back() != *block - 1))
+    {
+      blocks.push_back(*block - 1);
+    }
+    blocks.push_back(*block);
+  }
+  for (std::size_t i = 1; i < lists.size() && !blocks.empty(); i++)
+  {
+    const auto [first, last] = lists[i];
+    blocks.erase(std::remove_if(blocks.begin(), blocks.end(), [first = first, last = last](std::uint32_t block) {
+        return !std::binary_search(first, last, block) && !std::binary_search(first, last, block + 1);
+    }), blocks.end());
+  }
+  return blocks;
+}
+
+std::vector<sigscanner::corpus_index::file_ranges> sigscanner::corpus_index::ranges(const std::vector<sigscanner::signature> &signatures) const
+{
+  std::vector<file_ranges> result;
+  if (!this->is_open())
+  {
+    return result;
+  }
+  // Blocks that may hold the start of a match of any signature, or nothing if every block may
+  std::optional<std::vector<std::uint32_t>> blocks = std::vector<std::uint32_t>();
+  for (const sigscanner::signature &signature: signatures)
+  {
+    const std::optional<std::vector<std::uint32_t>> signature_blocks = this->candidate_blocks(signature);
+    if (!signature_blocks)
+    {
+      blocks.reset();
+      break;
+    }
+    std::vector<std::uint32_t> merged;
+    std::set_union(blocks->begin(), blocks->end(), signature_blocks->begin(), signature_blocks->end(), std::back_inserter(merged));
+    blocks = std::move(merged);
+  }
+
+  auto candidate = blocks ? blocks->begin() : std::vector<std::uint32_t>::iterator();
+  for (std::size_t i = 0; i < this->head->file_count; i++)
+  {
+    const file_record &file = this->files[i];
+    if (file.path_offset > this->head->path_bytes || file.path_length > this->head->path_bytes - file.path_offset)
+    {
+      continue;
+    }
+    file_ranges ranges{std::filesystem::u8path(this->paths + file.path_offset, this->paths + file.path_offset + file.path_length), file.size, false, {}};
+    // Each call clears the error on success, so one code can't be shared between them
+    std::error_code size_error, modified_error;
+    const std::uint64_t size = std::filesystem::file_size(ranges.path, size_error);
+    const std::filesystem::file_time_type modified = std::filesystem::last_write_time(ranges.path, modified_error);
+    if (size_error || modified_error)
+    {
+      continue; // Deleted since
+    }
+    ranges.changed = size != file.size || modified.time_since_epoch().count() != file.modified;
+    if (ranges.changed || !blocks)
+    {
+      ranges.size = size;
+      ranges.ranges.emplace_back(0, size);
+      result.push_back(std::move(ranges));
+      continue;
+    }
+    // The candidates are sorted and so are the files' blocks, so each file takes the ones up to its end
+    const std::uint64_t end_block = file.first_block + (file.size + this->head->block_size - 1) / this->head->block_size;
+    for (; candidate != blocks->end() && *candidate < end_block; candidate++)
+    {
+      if (*candidate < file.first_block)
+      {
+        continue;
+      }
+      const std::uint64_t begin = (*candidate - file.first_block) * this->head->block_size;
+      const std::uint64_t end = std::min(begin + this->head->block_size, file.size);
+      if (!ranges.ranges.empty() && ranges.ranges.back().second == begin)
+      {
+        ranges.ranges.back().second = end;
+      } else
+      {
+        ranges.ranges.emplace_back(begin, end);
+      }
+    }
+    result.push_back(std::move(ranges));
+  }
+  return result;
+}
@@ -0,0 +1,186 @@
+#include "directory_walker.hpp"
+#include <algorithm>
+
+#ifdef __linux__
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+sigscanner::directory_walker::directory_walker(const sigscanner::scan_options &options, sigscanner::thread_pool::task_group &tasks,
+                                               sigscanner::scan_limits &limits, sigscanner::directory_walker::file_callback on_file)
+        : options(options), tasks(tasks), limits(limits), on_file(std::move(on_file))
+{
+}
+
+#ifdef __linux__
+
+namespace
+{
+  // What getdents64 fills the buffer with, glibc only declares it from 2.30 on
+  struct linux_dirent64
+  {
+    std::uint64_t d_ino;
+    std::int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[1]; // Actually d_reclen - offsetof(d_name) bytes, null terminated
+  };
+
+  constexpr std::size_t dirent_buffer_size = 32768;
+  constexpr int directory_flags = O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC;
+
+  // getdents64 can leave the type out, DT_UNKNOWN if it can't be found either
+  unsigned char entry_type(int dir_fd, const char *name)
+  {
+    struct stat st{};
+    if (fstatat(dir_fd, name, &st, AT_SYMLINK_NOFOLLOW) != 0)
+    {
+      return DT_UNKNOWN;
+    }
+    if (S_ISDIR(st.st_mode))
+    {
+      return DT_DIR;
+    }
+    if (S_ISREG(st.st_mode))
+    {
+      return DT_REG;
+    }
+    return S_ISLNK(st.st_mode) ? DT_LNK : DT_UNKNOWN;
+  }
+}
+
+struct sigscanner::directory_walker::directory
+{
+  directory(int fd, std::atomic<std::size_t> &open_directories) : fd(fd), open_directories(open_directories)
+  {
+    this->open_directories++;
+  }
+
+  ~directory()
+  {
+    close(this->fd);
+    this->open_directories--;
+  }
+
+  directory(const directory &copy) = delete;
+  directory &operator=(const directory &copy) = delete;
+
+  const int fd;
+  std::atomic<std::size_t> &open_directories;
+};
+
+void sigscanner::directory_walker::walk(const std::filesystem::path &root)
+{
+  if (!this->options.check_depth(0))
+  {
+    return;
+  }
+  // Leave most descriptors for the files being scanned
+  struct rlimit limit{};
+  if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur != RLIM_INFINITY)
+  {
+    this->max_open_directories = std::min<std::size_t>(this->max_open_directories, limit.rlim_cur / 4);
+  }
+  const int fd = open(root.c_str(), directory_flags & ~O_NOFOLLOW);
+  if (fd < 0)
+  {
+    return;
+  }
+  this->read_directory(std::make_shared<directory>(fd, this->open_directories), root, 0);
+}
+
+void sigscanner::directory_walker::read_directory(const std::shared_ptr<directory> &dir, const std::filesystem::path &path, int depth)
+{
+  alignas(linux_dirent64) char buffer[dirent_buffer_size];
+  while (!this->limits.stopped())
+  {
+    const long read = syscall(SYS_getdents64, dir->fd, buffer, sizeof(buffer));
+    if (read <= 0)
+    {
+      return;
+    }
+    for (long pos = 0; pos < read;)
+    {
+      const auto *entry = reinterpret_cast<const linux_dirent64 *>(buffer + pos);
+      pos += entry->d_reclen;
+      const char *name = entry->d_name;
+      if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0')))
+      {
+        continue;
+      }
+      const unsigned char type = entry->d_type == DT_UNKNOWN ? entry_type(dir->fd, name) : entry->d_type;
+      if (type == DT_REG || type == DT_LNK)
+      {
+        std::filesystem::path file_path = path / name;
+        if (!this->options.check_extension(file_path) || !this->options.check_filename(file_path))
+        {
+          continue;
+        }
+        // Symlinks to regular files are scanned like the file itself, symlinks to directories aren't entered
+        struct stat st{};
+        if (fstatat(dir->fd, name, &st, 0) == 0 && S_ISREG(st.st_mode))
+        {
+          this->on_file(file_path, static_cast<std::uint64_t>(st.st_size));
+        }
+      } else if (type == DT_DIR && this->options.check_depth(depth + 1))
+      {
+        this->add_directory(dir, path / name, depth + 1);
+      }
+    }
+  }
+}
+
+void sigscanner::directory_walker::add_directory(const std::shared_ptr<directory> &parent, std::filesystem::path &&path, int depth)
+{
+  // Keep the parent open so the subdirectory can be opened relative to it, unless too many already are
+  std::shared_ptr<directory> relative_to = this->open_directories < this->max_open_directories ? parent : nullptr;
+  this->tasks.add_task([relative_to = std::move(relative_to), path = std::move(path), depth, this]() mutable {
+      if (this->limits.stopped())
+      {
+        return;
+      }
+      const int fd = relative_to != nullptr ? openat(relative_to->fd, path.filename().c_str(), directory_flags) : open(path.c_str(), directory_flags);
+      relative_to.reset();
+      if (fd < 0)
+      {
+        return;
+      }
+      this->read_directory(std::make_shared<directory>(fd, this->open_directories), path, depth);
+  });
+}
+
+#else
+
+void sigscanner::directory_walker::walk(const std::filesystem::path &root)
+{
+  typedef std::filesystem::recursive_directory_iterator recursive_directory_iterator;
+  for (auto it = recursive_directory_iterator(root); it != recursive_directory_iterator() && !this->limits.stopped(); it++)
+  {
+    if (!this->options.check_depth(it.depth()))
+    {
+      it.disable_recursion_pending();
+      continue;
+    }
+    if (!it->is_regular_file())
+    {
+      continue;
+    }
+    const std::filesystem::path &file_path = it->path();
+    if (!this->options.check_extension(file_path) || !this->options.check_filename(file_path))
+    {
+      continue;
+    }
+    std::error_code error;
+    const std::uint64_t size = it->file_size(error);
+    if (!error)
+    {
+      this->on_file(file_path, size);
+    }
+  }
+}
+
+#endif
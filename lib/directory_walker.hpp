@@ -0,0 +1,42 @@
+#pragma once
+
+#include "sigscanner/sigscanner.hpp"
+#include "scan_limits.hpp"
+
+namespace sigscanner
+{
+    /*
+     * Walks a directory tree with the depth, extension and filename filters of scan_options applied,
+     * calling on_file with the path and size of every regular file found. Directory symlinks aren't followed.
+     *
+     * On Linux every directory is read with getdents64 in its own task of the group and opened relative
+     * to its parent, so the walk is spread over the pool and files are handed out while other
+     * directories are still being read. Elsewhere the tree is walked on the calling thread.
+     * Directories that can't be opened are skipped.
+     */
+    class directory_walker
+    {
+    public:
+        typedef std::function<void(const std::filesystem::path &path, std::uint64_t size)> file_callback;
+
+        directory_walker(const scan_options &options, thread_pool::task_group &tasks, scan_limits &limits, file_callback on_file);
+        directory_walker(const directory_walker &copy) = delete;
+        directory_walker &operator=(const directory_walker &copy) = delete;
+
+        // Reads root on the calling thread, its subdirectories are read by tasks of the group
+        void walk(const std::filesystem::path &root);
+
+    private:
+        struct directory;
+
+        void read_directory(const std::shared_ptr<directory> &dir, const std::filesystem::path &path, int depth);
+        void add_directory(const std::shared_ptr<directory> &parent, std::filesystem::path &&path, int depth);
+
+        const scan_options &options;
+        thread_pool::task_group &tasks;
+        scan_limits &limits;
+        const file_callback on_file;
+        std::size_t max_open_directories = SIGSCANNER_MAX_OPEN_DIRECTORIES;
+        std::atomic<std::size_t> open_directories = 0;
+    };
+}
@@ -0,0 +1,205 @@
+#include "elf_ranges.hpp"
+#include <algorithm>
+#include <cstring>
+
+namespace
+{
+  // The few values of the System V ABI that are needed
+  constexpr std::uint32_t pt_load = 1;
+  constexpr std::uint32_t pf_x = 1;
+  constexpr std::uint32_t sht_nobits = 8;
+  constexpr std::uint64_t shf_execinstr = 4;
+  constexpr std::uint64_t extended_count = 0xffff; // PN_XNUM and SHN_XINDEX, the real value is in the first section header
+
+  // Where the fields used are in each class. Addresses, offsets, sizes and section flags are word sized, the counts 2 bytes and the rest 4
+  struct elf_layout
+  {
+      std::size_t word;
+      std::size_t header_size;
+      std::size_t e_phoff, e_shoff, e_phentsize, e_phnum, e_shentsize, e_shnum, e_shstrndx;
+      std::size_t program_header_size;
+      std::size_t p_type, p_flags, p_offset, p_vaddr, p_filesz;
+      std::size_t section_header_size;
+      std::size_t sh_name, sh_type, sh_flags, sh_addr, sh_offset, sh_size, sh_link, sh_info;
+  };
+
+  constexpr elf_layout elf32{4, 52,
+                             0x1c, 0x20, 0x2a, 0x2c, 0x2e, 0x30, 0x32,
+                             32, 0, 24, 4, 8, 16,
+                             40, 0, 4, 8, 12, 16, 20, 24, 28};
+  constexpr elf_layout elf64{8, 64,
+                             0x20, 0x28, 0x36, 0x38, 0x3a, 0x3c, 0x3e,
+                             56, 0, 4, 8, 16, 32,
+                             64, 0, 4, 8, 16, 24, 32, 40, 44};
+
+  std::uint64_t read_field(const sigscanner::byte *data, std::size_t size, bool big_endian)
+  {
+    std::uint64_t value = 0;
+    for (std::size_t i = 0; i < size; i++)
+    {
+      value |= static_cast<std::uint64_t>(data[big_endian ? size - 1 - i : i]) << (8 * i);
+    }
+    return value;
+  }
+}
+
+std::optional<std::vector<sigscanner::elf_range>> sigscanner::find_elf_ranges(const sigscanner::elf_reader &read, std::uint64_t file_size,
+                                                                              sigscanner::scan_options::elf_mode mode, const std::vector<std::string_view> &sections)
+{
+  std::array<sigscanner::byte, 64> header{};
+  if (file_size < elf32.header_size || !read(0, std::min<std::uint64_t>(header.size(), file_size), header.data())
+      || std::memcmp(header.data(), "\x7f" "ELF", 4) != 0 || (header[4] != 1 && header[4] != 2) || (header[5] != 1 && header[5] != 2))
+  {
+    return std::nullopt;
+  }
+  const elf_layout &layout = header[4] == 2 ? elf64 : elf32;
+  const bool big_endian = header[5] == 2;
+  if (file_size < layout.header_size)
+  {
+    return std::nullopt;
+  }
+  const auto field = [big_endian](const sigscanner::byte *data, std::size_t offset, std::size_t size) {
+      return read_field(data + offset, size, big_endian);
+  };
+  // Tables are checked against the file size before anything is allocated for them
+  const auto read_table = [&read, file_size](std::uint64_t offset, std::uint64_t count, std::uint64_t entry_size, std::size_t min_entry_size,
+                                             std::vector<sigscanner::byte> &table) {
+      table.clear();
+      if (count == 0)
+      {
+        return true;
+      }
+      if (entry_size < min_entry_size || offset > file_size || count > (file_size - offset) / entry_size)
+      {
+        return false;
+      }
+      table.resize(static_cast<std::size_t>(count * entry_size));
+      return read(offset, table.size(), table.data());
+  };
+
+  std::uint64_t program_count = field(header.data(), layout.e_phnum, 2);
+  std::uint64_t section_count = field(header.data(), layout.e_shnum, 2);
+  std::uint64_t names_index = field(header.data(), layout.e_shstrndx, 2);
+  const std::uint64_t section_table = field(header.data(), layout.e_shoff, layout.word);
+  const std::uint64_t section_entry_size = field(header.data(), layout.e_shentsize, 2);
+  std::vector<sigscanner::byte> table;
+  if (section_table != 0)
+  {
+    if (!read_table(section_table, 1, section_entry_size, layout.section_header_size, table))
+    {
+      return std::nullopt;
+    }
+    if (section_count == 0)
+    {
+      section_count = field(table.data(), layout.sh_size, layout.word);
+    }
+    if (names_index == extended_count)
+    {
+      names_index = field(table.data(), layout.sh_link, 4);
+    }
+    if (program_count == extended_count)
+    {
+      program_count = field(table.data(), layout.sh_info, 4);
+    }
+  } else
+  {
+    section_count = 0;
+  }
+
+  std::vector<sigscanner::elf_range> ranges;
+  if (mode == sigscanner::scan_options::elf_mode::SECTIONS && section_count > 0)
+  {
+    if (!read_table(section_table, section_count, section_entry_size, layout.section_header_size, table))
+    {
+      return std::nullopt;
+    }
+    std::vector<sigscanner::byte> names;
+    if (!sections.empty())
+    {
+      if (names_index >= section_count)
+      {
+        return std::nullopt;
+      }
+      const sigscanner::byte *names_header = table.data() + names_index * section_entry_size;
+      if (!read_table(field(names_header, layout.sh_offset, layout.word), field(names_header, layout.sh_size, layout.word), 1, 1, names))
+      {
+        return std::nullopt;
+      }
+    }
+    for (std::uint64_t i = 0; i < section_count; i++)
+    {
+      const sigscanner::byte *section = table.data() + i * section_entry_size;
+      if (field(section, layout.sh_type, 4) == sht_nobits)
+      {
+        continue; // Takes no space in the file, like .bss
+      }
+      if (sections.empty())
+      {
+        if ((field(section, layout.sh_flags, layout.word) & shf_execinstr) == 0)
+        {
+          continue;
+        }
+      } else
+      {
+        const std::uint64_t name_offset = field(section, layout.sh_name, 4);
+        if (name_offset >= names.size())
+        {
+          continue;
+        }
+        const char *name = reinterpret_cast<const char *>(names.data() + name_offset);
+        if (std::find(sections.begin(), sections.end(), std::string_view(name, strnlen(name, names.size() - name_offset))) == sections.end())
+        {
+          continue;
+        }
+      }
+      ranges.push_back({field(section, layout.sh_offset, layout.word), field(section, layout.sh_size, layout.word), field(section, layout.sh_addr, layout.word)});
+    }
+  } else
+  {
+    // Without a section table the segments are all there is to go by
+    const std::uint64_t program_entry_size = field(header.data(), layout.e_phentsize, 2);
+    if (!read_table(field(header.data(), layout.e_phoff, layout.word), program_count, program_entry_size, layout.program_header_size, table))
+    {
+      return std::nullopt;
+    }
+    for (std::uint64_t i = 0; i < program_count; i++)
+    {
+      const sigscanner::byte *segment = table.data() + i * program_entry_size;
+      if (field(segment, layout.p_type, 4) == pt_load && (field(segment, layout.p_flags, 4) & pf_x) != 0)
+      {
+        ranges.push_back({field(segment, layout.p_offset, layout.word), field(segment, layout.p_filesz, layout.word), field(segment, layout.p_vaddr, layout.word)});
+      }
+    }
+  }
+
+  // Clipped to the file first, so the overlap check below can't overflow
+  std::vector<sigscanner::elf_range> clipped;
+  for (sigscanner::elf_range range: ranges)
+  {
+    if (range.offset < file_size)
+    {
+      range.size = std::min(range.size, file_size - range.offset);
+      clipped.push_back(range);
+    }
+  }
+  std::sort(clipped.begin(), clipped.end(), [](const sigscanner::elf_range &a, const sigscanner::elf_range &b) {
+      return a.offset < b.offset;
+  });
+  ranges.clear();
+  for (sigscanner::elf_range range: clipped)
+  {
+    // Overlapping segments would otherwise be scanned, and their matches reported, twice
+    if (!ranges.empty() && range.offset < ranges.back().offset + ranges.back().size)
+    {
+      const std::uint64_t overlap = std::min(range.size, ranges.back().offset + ranges.back().size - range.offset);
+      range.offset += overlap;
+      range.address += overlap;
+      range.size -= overlap;
+    }
+    if (range.size > 0)
+    {
+      ranges.push_back(range);
+    }
+  }
+  return ranges;
+}
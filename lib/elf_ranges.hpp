@@ -0,0 +1,25 @@
+#pragma once
+
+#include "sigscanner/sigscanner.hpp"
+
+namespace sigscanner
+{
+    // Part of an ELF file picked by scan_options::elf_mode
+    struct elf_range
+    {
+        std::uint64_t offset; // In the file
+        std::uint64_t size;
+        std::uint64_t address; // Virtual address offset is loaded at
+    };
+
+    // Copy size bytes at offset into data. False if the file is too short
+    typedef std::function<bool(std::uint64_t offset, std::uint64_t size, byte *data)> elf_reader;
+
+    /*
+     * Read the headers of an ELF file of either class and byte order and pick the parts mode selects.
+     * Only the headers and the section name table are read. Nothing if the file isn't ELF or its
+     * headers point outside of it. The ranges are sorted, don't overlap and end within the file.
+     */
+    std::optional<std::vector<elf_range>> find_elf_ranges(const elf_reader &read, std::uint64_t file_size, scan_options::elf_mode mode,
+                                                          const std::vector<std::string_view> &sections);
+}
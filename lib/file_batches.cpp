@@ -0,0 +1,43 @@
+#include "file_batches.hpp"
+
+namespace
+{
+    // Opening a file costs about as much as reading this many bytes, so batches of empty files stay bounded too
+    constexpr std::uint64_t file_overhead = 4096;
+}
+
+sigscanner::file_batches::file_batches(sigscanner::thread_pool::task_group &tasks, sigscanner::file_batches::batch_callback scan_batch)
+        : tasks(tasks), scan_batch(std::move(scan_batch))
+{
+}
+
+void sigscanner::file_batches::add(const std::filesystem::path &path, std::uint64_t size)
+{
+  batch &local = this->batches.local();
+  local.files.push_back({path, size});
+  local.bytes += size + file_overhead;
+  if (local.bytes >= SIGSCANNER_FILE_BATCH_SIZE)
+  {
+    this->queue(local);
+  }
+}
+
+void sigscanner::file_batches::flush()
+{
+  for (batch &batch: this->batches)
+  {
+    if (!batch.files.empty())
+    {
+      this->queue(batch);
+    }
+  }
+}
+
+void sigscanner::file_batches::queue(sigscanner::file_batches::batch &full)
+{
+  this->tasks.add_task([files = std::move(full.files), this] {
+      this->scan_batch(files);
+  });
+  full.files = std::vector<file>();
+  full.bytes = 0;
+}
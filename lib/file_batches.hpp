@@ -0,0 +1,47 @@
+#pragma once
+
+#include "sigscanner/sigscanner.hpp"
+#include "thread_shards.hpp"
+
+namespace sigscanner
+{
+    /*
+     * Groups small files into tasks of about SIGSCANNER_FILE_BATCH_SIZE bytes, so each file doesn't
+     * cost a task, a stream and a buffer of its own. Every thread fills its own batch and queues it
+     * once full, so adding files never waits on another thread.
+     */
+    class file_batches
+    {
+    public:
+        struct file
+        {
+            std::filesystem::path path;
+            std::uint64_t size;
+        };
+
+        typedef std::function<void(const std::vector<file> &files)> batch_callback;
+
+        file_batches(thread_pool::task_group &tasks, batch_callback scan_batch);
+        file_batches(const file_batches &copy) = delete;
+        file_batches &operator=(const file_batches &copy) = delete;
+
+        // Safe to call from any number of threads at once
+        void add(const std::filesystem::path &path, std::uint64_t size);
+
+        // Queue the batches that aren't full yet. Must not be called while files are still being added
+        void flush();
+
+    private:
+        struct batch
+        {
+            std::vector<file> files;
+            std::uint64_t bytes = 0;
+        };
+
+        void queue(batch &full);
+
+        thread_pool::task_group &tasks;
+        const batch_callback scan_batch;
+        thread_shards<batch> batches;
+    };
+}
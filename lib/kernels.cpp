@@ -0,0 +1,426 @@
+#include "kernels.hpp"
+#include <algorithm>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define SIGSCANNER_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+#if defined(_MSC_VER) && !defined(__clang__)
+#define SIGSCANNER_TARGET(x)
+#else
+#define SIGSCANNER_TARGET(x) __attribute__((target(x)))
+#endif
+
+namespace
+{
+    using sigscanner::byte;
+    using sigscanner::kernels::npos;
+    using sigscanner::kernels::pattern_view;
+
+    inline unsigned count_trailing_zeros(std::uint64_t value)
+    {
+#ifdef _MSC_VER
+      unsigned long index;
+      _BitScanForward64(&index, value);
+      return static_cast<unsigned>(index);
+#else
+      return static_cast<unsigned>(__builtin_ctzll(value));
+#endif
+    }
+
+    inline unsigned highest_set_bit(std::uint64_t value)
+    {
+#ifdef _MSC_VER
+      unsigned long index;
+      _BitScanReverse64(&index, value);
+      return static_cast<unsigned>(index);
+#else
+      return 63u - static_cast<unsigned>(__builtin_clzll(value));
+#endif
+    }
+
+    /*
+     * The kernels below take the view by value. Counting a candidate stores through a pointer that could
+     * alias a referenced view, which would make every iteration reload the anchors.
+     */
+    inline bool verify(const pattern_view &view, const byte *data)
+    {
+      if (view.candidates != nullptr)
+      {
+        ++*view.candidates;
+      }
+      return sigscanner::kernels::verify_packed(view.packed, view.length, data);
+    }
+
+    inline bool check_candidate(const pattern_view &view, const byte *data)
+    {
+      return data[view.second_anchor] == view.pattern[view.second_anchor] && verify(view, data);
+    }
+
+    /*
+     * Jumps between occurrences of the first anchor with memchr. Every other kernel falls back to this
+     * for the positions that don't fill a whole vector, which keeps the results identical across levels.
+     */
+    std::size_t find_scalar(pattern_view view, const byte *data, std::size_t first, std::size_t last)
+    {
+      const byte value = view.pattern[view.first_anchor];
+      const byte *anchor_data = data + view.first_anchor;
+      for (std::size_t pos = first; pos <= last; pos++)
+      {
+        const void *hit = std::memchr(anchor_data + pos, value, last - pos + 1);
+        if (hit == nullptr)
+        {
+          return npos;
+        }
+        pos = static_cast<std::size_t>(static_cast<const byte *>(hit) - anchor_data);
+        if (check_candidate(view, data + pos))
+        {
+          return pos;
+        }
+      }
+      return npos;
+    }
+
+    std::size_t rfind_scalar(pattern_view view, const byte *data, std::size_t first, std::size_t last)
+    {
+      const byte value = view.pattern[view.first_anchor];
+      for (std::size_t pos = last + 1; pos-- > first;)
+      {
+        if (data[pos + view.first_anchor] == value && check_candidate(view, data + pos))
+        {
+          return pos;
+        }
+      }
+      return npos;
+    }
+
+    /*
+     * Tuned Horspool: the shift for the byte ending the window is stored as 0, so the skip loop only
+     * stops where the window end matches and needs no comparison. The loop is unrolled while even the
+     * largest shifts stay inside the data.
+     */
+    std::size_t find_horspool(pattern_view view, const byte *data, std::size_t first, std::size_t last)
+    {
+      const std::uint16_t *shift = view.horspool_shift;
+      const byte *end_data = data + view.horspool_end;
+      const std::size_t max_shift = view.horspool_end + 1;
+      std::size_t pos = first;
+      while (pos <= last)
+      {
+        std::size_t step = shift[end_data[pos]];
+        while (step != 0 && last - pos >= 3 * max_shift)
+        {
+          pos += step;
+          pos += shift[end_data[pos]];
+          pos += shift[end_data[pos]];
+          step = shift[end_data[pos]];
+        }
+        while (step != 0)
+        {
+          pos += step;
+          if (pos > last)
+          {
+            return npos;
+          }
+          step = shift[end_data[pos]];
+        }
+        if (verify(view, data + pos))
+        {
+          return pos;
+        }
+        pos += view.horspool_match_shift;
+      }
+      return npos;
+    }
+
+#ifdef SIGSCANNER_X86
+    /*
+     * Each iteration tests a vector's width of consecutive positions by comparing the bytes at both
+     * anchors, only positions where both anchors match are verified. Loads never read past
+     * data[last + length - 1] because the anchors are inside the pattern.
+     */
+    SIGSCANNER_TARGET("sse2")
+    std::size_t find_sse2(pattern_view view, const byte *data, std::size_t first, std::size_t last)
+    {
+      const __m128i first_value = _mm_set1_epi8(static_cast<char>(view.pattern[view.first_anchor]));
+      const __m128i second_value = _mm_set1_epi8(static_cast<char>(view.pattern[view.second_anchor]));
+      std::size_t pos = first;
+      for (; pos <= last && last - pos >= 15; pos += 16)
+      {
+        const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + pos + view.first_anchor));
+        const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + pos + view.second_anchor));
+        std::uint64_t candidates = static_cast<std::uint32_t>(_mm_movemask_epi8(
+                _mm_and_si128(_mm_cmpeq_epi8(a, first_value), _mm_cmpeq_epi8(b, second_value))));
+        while (candidates)
+        {
+          const std::size_t candidate = pos + count_trailing_zeros(candidates);
+          if (verify(view, data + candidate))
+          {
+            return candidate;
+          }
+          candidates &= candidates - 1;
+        }
+      }
+      return pos <= last ? find_scalar(view, data, pos, last) : npos;
+    }
+
+    SIGSCANNER_TARGET("sse2")
+    std::size_t rfind_sse2(pattern_view view, const byte *data, std::size_t first, std::size_t last)
+    {
+      const __m128i first_value = _mm_set1_epi8(static_cast<char>(view.pattern[view.first_anchor]));
+      const __m128i second_value = _mm_set1_epi8(static_cast<char>(view.pattern[view.second_anchor]));
+      std::size_t end = last + 1; // One past the highest position left to test
+      for (; end - first >= 16; end -= 16)
+      {
+        const std::size_t pos = end - 16;
+        const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + pos + view.first_anchor));
+        const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + pos + view.second_anchor));
+        std::uint64_t candidates = static_cast<std::uint32_t>(_mm_movemask_epi8(
+                _mm_and_si128(_mm_cmpeq_epi8(a, first_value), _mm_cmpeq_epi8(b, second_value))));
+        while (candidates)
+        {
+          const unsigned bit = highest_set_bit(candidates);
+          if (verify(view, data + pos + bit))
+          {
+            return pos + bit;
+          }
+          candidates &= ~(std::uint64_t(1) << bit);
+        }
+      }
+      return end > first ? rfind_scalar(view, data, first, end - 1) : npos;
+    }
+
+    SIGSCANNER_TARGET("avx2")
+    std::size_t find_avx2(pattern_view view, const byte *data, std::size_t first, std::size_t last)
+    {
+      const __m256i first_value = _mm256_set1_epi8(static_cast<char>(view.pattern[view.first_anchor]));
+      const __m256i second_value = _mm256_set1_epi8(static_cast<char>(view.pattern[view.second_anchor]));
+      std::size_t pos = first;
+      for (; pos <= last && last - pos >= 31; pos += 32)
+      {
+        const __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + pos + view.first_anchor));
+        const __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + pos + view.second_anchor));
+        std::uint64_t candidates = static_cast<std::uint32_t>(_mm256_movemask_epi8(
+                _mm256_and_si256(_mm256_cmpeq_epi8(a, first_value), _mm256_cmpeq_epi8(b, second_value))));
+        while (candidates)
+        {
+          const std::size_t candidate = pos + count_trailing_zeros(candidates);
+          if (verify(view, data + candidate))
+          {
+            return candidate;
+          }
+          candidates &= candidates - 1;
+        }
+      }
+      return pos <= last ? find_sse2(view, data, pos, last) : npos;
+    }
+
+    SIGSCANNER_TARGET("avx2")
+    std::size_t rfind_avx2(pattern_view view, const byte *data, std::size_t first, std::size_t last)
+    {
+      const __m256i first_value = _mm256_set1_epi8(static_cast<char>(view.pattern[view.first_anchor]));
+      const __m256i second_value = _mm256_set1_epi8(static_cast<char>(view.pattern[view.second_anchor]));
+      std::size_t end = last + 1;
+      for (; end - first >= 32; end -= 32)
+      {
+        const std::size_t pos = end - 32;
+        const __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + pos + view.first_anchor));
+        const __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + pos + view.second_anchor));
+        std::uint64_t candidates = static_cast<std::uint32_t>(_mm256_movemask_epi8(
+                _mm256_and_si256(_mm256_cmpeq_epi8(a, first_value), _mm256_cmpeq_epi8(b, second_value))));
+        while (candidates)
+        {
+          const unsigned bit = highest_set_bit(candidates);
+          if (verify(view, data + pos + bit))
+          {
+            return pos + bit;
+          }
+          candidates &= ~(std::uint64_t(1) << bit);
+        }
+      }
+      return end > first ? rfind_sse2(view, data, first, end - 1) : npos;
+    }
+
+    SIGSCANNER_TARGET("avx512f,avx512bw")
+    std::size_t find_avx512(pattern_view view, const byte *data, std::size_t first, std::size_t last)
+    {
+      const __m512i first_value = _mm512_set1_epi8(static_cast<char>(view.pattern[view.first_anchor]));
+      const __m512i second_value = _mm512_set1_epi8(static_cast<char>(view.pattern[view.second_anchor]));
+      std::size_t pos = first;
+      for (; pos <= last && last - pos >= 63; pos += 64)
+      {
+        const __m512i a = _mm512_loadu_si512(data + pos + view.first_anchor);
+        const __m512i b = _mm512_loadu_si512(data + pos + view.second_anchor);
+        std::uint64_t candidates = _mm512_cmpeq_epi8_mask(a, first_value) & _mm512_cmpeq_epi8_mask(b, second_value);
+        while (candidates)
+        {
+          const std::size_t candidate = pos + count_trailing_zeros(candidates);
+          if (verify(view, data + candidate))
+          {
+            return candidate;
+          }
+          candidates &= candidates - 1;
+        }
+      }
+      return pos <= last ? find_avx2(view, data, pos, last) : npos;
+    }
+
+    SIGSCANNER_TARGET("avx512f,avx512bw")
+    std::size_t rfind_avx512(pattern_view view, const byte *data, std::size_t first, std::size_t last)
+    {
+      const __m512i first_value = _mm512_set1_epi8(static_cast<char>(view.pattern[view.first_anchor]));
+      const __m512i second_value = _mm512_set1_epi8(static_cast<char>(view.pattern[view.second_anchor]));
+      std::size_t end = last + 1;
+      for (; end - first >= 64; end -= 64)
+      {
+        const std::size_t pos = end - 64;
+        const __m512i a = _mm512_loadu_si512(data + pos + view.first_anchor);
+        const __m512i b = _mm512_loadu_si512(data + pos + view.second_anchor);
+        std::uint64_t candidates = _mm512_cmpeq_epi8_mask(a, first_value) & _mm512_cmpeq_epi8_mask(b, second_value);
+        while (candidates)
+        {
+          const unsigned bit = highest_set_bit(candidates);
+          if (verify(view, data + pos + bit))
+          {
+            return pos + bit;
+          }
+          candidates &= ~(std::uint64_t(1) << bit);
+        }
+      }
+      return end > first ? rfind_avx2(view, data, first, end - 1) : npos;
+    }
+#endif
+
+    sigscanner::simd_level detect_simd_level()
+    {
+#ifdef SIGSCANNER_X86
+#ifdef _MSC_VER
+      int info[4];
+      __cpuid(info, 0);
+      const int max_leaf = info[0];
+      __cpuid(info, 1);
+      const bool sse2 = (info[3] & (1 << 26)) != 0;
+      const bool osxsave = (info[2] & (1 << 27)) != 0;
+      const bool avx = (info[2] & (1 << 28)) != 0;
+      const unsigned long long xcr0 = osxsave ? _xgetbv(0) : 0;
+      bool avx2 = false;
+      bool avx512 = false;
+      if (max_leaf >= 7 && avx && (xcr0 & 0x6) == 0x6)
+      {
+        __cpuidex(info, 7, 0);
+        avx2 = (info[1] & (1 << 5)) != 0;
+        avx512 = (info[1] & (1 << 16)) != 0 && (info[1] & (1 << 30)) != 0 && (xcr0 & 0xE0) == 0xE0;
+      }
+#else
+      __builtin_cpu_init();
+      const bool sse2 = __builtin_cpu_supports("sse2");
+      const bool avx2 = __builtin_cpu_supports("avx2");
+      const bool avx512 = __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw");
+#endif
+      if (avx512)
+        return sigscanner::simd_level::AVX512;
+      if (avx2)
+        return sigscanner::simd_level::AVX2;
+      if (sse2)
+        return sigscanner::simd_level::SSE2;
+#endif
+      return sigscanner::simd_level::SCALAR;
+    }
+
+    const sigscanner::simd_level max_simd_level = detect_simd_level();
+    std::atomic<sigscanner::simd_level> current_simd_level = max_simd_level;
+}
+
+sigscanner::simd_level sigscanner::get_max_simd_level()
+{
+  return max_simd_level;
+}
+
+sigscanner::simd_level sigscanner::get_simd_level()
+{
+  return current_simd_level.load(std::memory_order_relaxed);
+}
+
+void sigscanner::set_simd_level(sigscanner::simd_level level)
+{
+  current_simd_level = std::min(level, max_simd_level);
+}
+
+void sigscanner::kernels::pack(const byte *pattern, const signature::mask_type *mask, std::size_t length, std::uint64_t *packed)
+{
+  // Packed with the same loads that verify_packed uses on the data, so the byte order always agrees
+  std::vector<byte> values(length);
+  std::vector<byte> masks(length);
+  for (std::size_t i = 0; i < length; i++)
+  {
+    const bool literal = mask[i] == signature::mask_type::BYTE;
+    values[i] = literal ? pattern[i] : 0;
+    masks[i] = literal ? 0xFF : 0x00;
+  }
+  if (length < 8)
+  {
+    packed[0] = load_short(values.data(), length);
+    packed[1] = load_short(masks.data(), length);
+    return;
+  }
+  for (std::size_t offset = 0; offset < length - 8; offset += 8, packed += 2)
+  {
+    packed[0] = load_word(values.data() + offset);
+    packed[1] = load_word(masks.data() + offset);
+  }
+  packed[0] = load_word(values.data() + length - 8);
+  packed[1] = load_word(masks.data() + length - 8);
+}
+
+std::size_t sigscanner::kernels::find(const pattern_view &view, const byte *data, std::size_t size, std::size_t start)
+{
+  if (size < view.length || start > size - view.length)
+  {
+    return npos;
+  }
+  const std::size_t last = size - view.length;
+  if (view.horspool_shift != nullptr)
+  {
+    return find_horspool(view, data, start, last);
+  }
+  switch (get_simd_level())
+  {
+#ifdef SIGSCANNER_X86
+    case simd_level::AVX512:
+      return find_avx512(view, data, start, last);
+    case simd_level::AVX2:
+      return find_avx2(view, data, start, last);
+    case simd_level::SSE2:
+      return find_sse2(view, data, start, last);
+#endif
+    default:
+      return find_scalar(view, data, start, last);
+  }
+}
+
+std::size_t sigscanner::kernels::rfind(const pattern_view &view, const byte *data, std::size_t size, std::size_t start)
+{
+  if (size < view.length)
+  {
+    return npos;
+  }
+  const std::size_t last = std::min(start, size - view.length);
+  switch (get_simd_level())
+  {
+#ifdef SIGSCANNER_X86
+    case simd_level::AVX512:
+      return rfind_avx512(view, data, 0, last);
+    case simd_level::AVX2:
+      return rfind_avx2(view, data, 0, last);
+    case simd_level::SSE2:
+      return rfind_sse2(view, data, 0, last);
+#endif
+    default:
+      return rfind_scalar(view, data, 0, last);
+  }
+}
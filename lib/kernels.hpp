@@ -0,0 +1,96 @@
+#pragma once
+
+#include "sigscanner/sigscanner.hpp"
+#include <cstring>
+
+namespace sigscanner::kernels
+{
+    constexpr std::size_t npos = static_cast<std::size_t>(-1);
+
+    /*
+     * Signatures are verified from their pattern and mask packed into (value, mask) pairs of words,
+     * so 8 bytes are checked with one (load & mask) == value and no branch per byte.
+     *
+     * Patterns of at least 8 bytes get a pair for every 8 bytes, the last one covering the final 8
+     * bytes and overlapping the one before it. Shorter patterns get a single pair gathered the same
+     * way load_short reads the data. No load ever reads past the end of the pattern.
+     */
+    constexpr std::size_t packed_words(std::size_t length)
+    {
+      return length <= 8 ? 2 : 2 * ((length + 7) / 8);
+    }
+
+    void pack(const byte *pattern, const signature::mask_type *mask, std::size_t length, std::uint64_t *packed);
+
+    inline std::uint64_t load_word(const byte *data)
+    {
+      std::uint64_t word;
+      std::memcpy(&word, data, sizeof(word));
+      return word;
+    }
+
+    // The first and last 4 bytes for 4 to 7 bytes, otherwise the first, middle and last byte
+    inline std::uint64_t load_short(const byte *data, std::size_t length)
+    {
+      if (length >= 4)
+      {
+        std::uint32_t low;
+        std::uint32_t high;
+        std::memcpy(&low, data, sizeof(low));
+        std::memcpy(&high, data + length - 4, sizeof(high));
+        return low | static_cast<std::uint64_t>(high) << 32;
+      }
+      if (length == 0)
+      {
+        return 0;
+      }
+      return data[0] | static_cast<std::uint64_t>(data[length / 2]) << 8 | static_cast<std::uint64_t>(data[length - 1]) << 16;
+    }
+
+    inline bool verify_packed(const std::uint64_t *packed, std::size_t length, const byte *data)
+    {
+      if (length < 8)
+      {
+        return (load_short(data, length) & packed[1]) == packed[0];
+      }
+      for (std::size_t offset = 0; offset < length - 8; offset += 8, packed += 2)
+      {
+        if ((load_word(data + offset) & packed[1]) != packed[0])
+        {
+          return false;
+        }
+      }
+      return (load_word(data + length - 8) & packed[1]) == packed[0];
+    }
+
+    /*
+     * Everything a kernel needs to know about a signature. Candidate positions are found by
+     * searching for the byte at first_anchor (the rarest) and checking the byte at second_anchor,
+     * then every candidate is verified against the full pattern. Both anchors must be BYTE
+     * positions, they may be equal.
+     */
+    struct pattern_view
+    {
+        const byte *pattern;
+        const std::uint64_t *packed;
+        std::size_t length;
+        std::size_t first_anchor;
+        std::size_t second_anchor;
+        // If set, find() skips with these Horspool shifts for the window ending at horspool_end.
+        // The shift for the byte at horspool_end is 0, horspool_match_shift is used after verifying instead
+        const std::uint16_t *horspool_shift;
+        std::size_t horspool_end;
+        std::size_t horspool_match_shift;
+        std::uint64_t *candidates; // If set, incremented for every position verified against the whole pattern
+    };
+
+    /*
+     * Find the first match at a position >= start, or npos. The view must have at least one BYTE.
+     */
+    std::size_t find(const pattern_view &view, const byte *data, std::size_t size, std::size_t start);
+
+    /*
+     * Find the last match at a position <= start, or npos. The view must have at least one BYTE.
+     */
+    std::size_t rfind(const pattern_view &view, const byte *data, std::size_t size, std::size_t start);
+}
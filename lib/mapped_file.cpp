@@ -0,0 +1,115 @@
+#include "mapped_file.hpp"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+
+sigscanner::mapped_file::mapped_file(const std::filesystem::path &path)
+{
+  HANDLE file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr,
+                            OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+  if (file == INVALID_HANDLE_VALUE)
+  {
+    return;
+  }
+  LARGE_INTEGER file_size;
+  if (GetFileType(file) != FILE_TYPE_DISK || !GetFileSizeEx(file, &file_size) || file_size.QuadPart <= 0)
+  {
+    CloseHandle(file);
+    return;
+  }
+  HANDLE mapping_handle = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  CloseHandle(file);
+  if (mapping_handle == nullptr)
+  {
+    return;
+  }
+  void *view = MapViewOfFile(mapping_handle, FILE_MAP_READ, 0, 0, 0);
+  CloseHandle(mapping_handle); // The view keeps the mapping alive
+  if (view == nullptr)
+  {
+    return;
+  }
+  this->mapping = static_cast<const byte *>(view);
+  this->length = static_cast<std::uint64_t>(file_size.QuadPart);
+}
+
+sigscanner::mapped_file::~mapped_file()
+{
+  if (this->mapping != nullptr)
+  {
+    UnmapViewOfFile(this->mapping);
+  }
+}
+
+void sigscanner::mapped_file::will_need(std::uint64_t, std::uint64_t) const
+{
+}
+
+#else
+
+sigscanner::mapped_file::mapped_file(const std::filesystem::path &path)
+{
+  const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+  {
+    return;
+  }
+  struct stat st{};
+  if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size <= 0)
+  {
+    close(fd);
+    return;
+  }
+  void *view = mmap(nullptr, static_cast<std::size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd); // The mapping keeps the file alive
+  if (view == MAP_FAILED)
+  {
+    return;
+  }
+  madvise(view, static_cast<std::size_t>(st.st_size), MADV_SEQUENTIAL);
+  this->mapping = static_cast<const byte *>(view);
+  this->length = static_cast<std::uint64_t>(st.st_size);
+}
+
+sigscanner::mapped_file::~mapped_file()
+{
+  if (this->mapping != nullptr)
+  {
+    munmap(const_cast<byte *>(this->mapping), static_cast<std::size_t>(this->length));
+  }
+}
+
+void sigscanner::mapped_file::will_need(std::uint64_t offset, std::uint64_t size) const
+{
+  // madvise needs a page aligned address
+  static const std::uint64_t page_size = static_cast<std::uint64_t>(sysconf(_SC_PAGESIZE));
+  const std::uint64_t aligned_offset = offset - offset % page_size;
+  madvise(const_cast<byte *>(this->mapping + aligned_offset), static_cast<std::size_t>(size + offset - aligned_offset), MADV_WILLNEED);
+}
+
+#endif
+
+bool sigscanner::mapped_file::is_open() const
+{
+  return this->mapping != nullptr;
+}
+
+const sigscanner::byte *sigscanner::mapped_file::data() const
+{
+  return this->mapping;
+}
+
+std::uint64_t sigscanner::mapped_file::size() const
+{
+  return this->length;
+}
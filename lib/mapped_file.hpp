@@ -0,0 +1,30 @@
+#pragma once
+
+#include "sigscanner/sigscanner.hpp"
+
+namespace sigscanner
+{
+    /*
+     * Read-only view of a whole regular file. is_open() is false if the file couldn't be mapped, for
+     * example because it is empty, a pipe or a device, in which case it has to be read normally.
+     */
+    class mapped_file
+    {
+    public:
+        explicit mapped_file(const std::filesystem::path &path);
+        ~mapped_file();
+        mapped_file(const mapped_file &copy) = delete;
+        mapped_file &operator=(const mapped_file &copy) = delete;
+
+        bool is_open() const;
+        const byte *data() const;
+        std::uint64_t size() const;
+
+        // Hint that [offset, offset + length) is about to be read. Does nothing where unsupported
+        void will_need(std::uint64_t offset, std::uint64_t length) const;
+
+    private:
+        const byte *mapping = nullptr;
+        std::uint64_t length = 0;
+    };
+}
@@ -1,8 +1,43 @@
 #include "sigscanner/sigscanner.hpp"
+#include "aho_corasick.hpp"
+#include "mapped_file.hpp"
+#include "async_reader.hpp"
+#include "result_shards.hpp"
+#include "scan_limits.hpp"
+#include "directory_walker.hpp"
+#include "file_batches.hpp"
+#include "block_pool.hpp"
+#include "cache_session.hpp"
+#include "stats_shards.hpp"
+#include "process_memory.hpp"
+#include "elf_ranges.hpp"
+#include "stream_reader.hpp"
 #include <fstream>
 #include <algorithm>
 #include <cassert>
 #include <limits>
+#include <cstring>
+
+void scan_chunk(const std::vector<sigscanner::signature> &signatures, const sigscanner::aho_corasick *automaton,
+                const sigscanner::byte *chunk, std::uint64_t chunk_size, std::uint64_t chunk_offset, std::uint64_t owned_size,
+                const std::filesystem::path &path, sigscanner::scan_limits &limits, const sigscanner::scan_limits::file_state &state,
+                sigscanner::stats_shards *stats, const sigscanner::match_sink &sink);
+void scan_file_batch(const std::vector<sigscanner::signature> &signatures, const sigscanner::aho_corasick *automaton,
+                     const std::vector<sigscanner::file_batches::file> &files, sigscanner::scan_options::elf_mode elf,
+                     const std::vector<std::string_view> &elf_sections, sigscanner::scan_limits &limits, sigscanner::stats_shards *stats,
+                     const sigscanner::match_sink &sink);
+sigscanner::match_sink with_addresses(const sigscanner::match_sink &sink, std::uint64_t load_bias);
+void scan_stream_range(const std::vector<sigscanner::signature> &signatures, const sigscanner::aho_corasick *automaton, std::fstream &file,
+                       const std::filesystem::path &path, std::uint64_t file_size, std::uint64_t range_offset, std::uint64_t range_end, std::size_t longest_sig,
+                       sigscanner::scan_limits &limits, const sigscanner::scan_limits::file_state &state, sigscanner::stats_shards *stats,
+                       const sigscanner::match_sink &sink);
+void scan_region_range(const std::vector<sigscanner::signature> &signatures, const sigscanner::aho_corasick *automaton, const sigscanner::process_memory &memory,
+                       const sigscanner::process_region &region, std::uint64_t range_offset, std::uint64_t range_end, std::size_t longest_sig,
+                       sigscanner::scan_limits &limits, const sigscanner::scan_limits::file_state &state, sigscanner::stats_shards *stats,
+                       const sigscanner::region_sink &sink);
+void scan_region_batch(const std::vector<sigscanner::signature> &signatures, const sigscanner::aho_corasick *automaton, const sigscanner::process_memory &memory,
+                       const std::vector<const sigscanner::process_region *> &regions, std::size_t longest_sig, sigscanner::scan_limits &limits,
+                       sigscanner::stats_shards *stats, const sigscanner::region_sink &sink);
 
 sigscanner::multi_scanner::multi_scanner(const sigscanner::signature &signature)
 {
@@ -17,111 +52,656 @@ sigscanner::multi_scanner::multi_scanner(const std::vector<sigscanner::signature
 void sigscanner::multi_scanner::add_signature(const sigscanner::signature &signature)
 {
   this->signatures.push_back(signature);
+  std::lock_guard<std::mutex> lock(this->automaton_mutex);
+  this->automaton.reset();
 }
 
 void sigscanner::multi_scanner::add_signatures(const std::vector<sigscanner::signature> &sigs)
 {
   this->signatures.insert(this->signatures.end(), sigs.begin(), sigs.end());
+  std::lock_guard<std::mutex> lock(this->automaton_mutex);
+  this->automaton.reset();
+}
+
+void sigscanner::multi_scanner::prepare() const
+{
+  this->get_automaton();
 }
 
 std::unordered_map<sigscanner::signature, std::vector<sigscanner::offset>>
 sigscanner::multi_scanner::scan(const sigscanner::byte *data, std::size_t len, const scan_options &options) const
 {
+  // Each task writes its own slot so no lock is needed
+  std::vector<std::vector<sigscanner::offset>> offsets(this->signatures.size());
+  const std::unique_ptr<sigscanner::stats_shards> stats = options.stats != nullptr ? std::make_unique<sigscanner::stats_shards>(this->signatures.size()) : nullptr;
+  {
+    const std::shared_ptr<sigscanner::thread_pool> pool = this->get_thread_pool(options);
+    sigscanner::scan_limits limits(options);
+    const sigscanner::scan_limits::file_state buffer = limits.start_file();
+    sigscanner::thread_pool::task_group tasks(*pool, stats.get());
+    for (std::size_t i = 0; i < this->signatures.size(); i++)
+    {
+      tasks.add_task([&offsets, &limits, &buffer, &stats, i, data, len, this] {
+          if (limits.skip_file(buffer))
+          {
+            return;
+          }
+          const sigscanner::stats_timer timer(stats.get(), &sigscanner::scan_stats::match_time);
+          if (stats != nullptr)
+          {
+            sigscanner::scan_stats::signature_counts &counts = stats->local().signatures[i];
+            offsets[i] = this->signatures[i].scan(data, len, 0, limits.match_limit(), counts.candidates);
+            counts.verified += offsets[i].size();
+          } else
+          {
+            offsets[i] = this->signatures[i].scan(data, len, 0, limits.match_limit());
+          }
+          offsets[i].resize(limits.claim(offsets[i].size(), buffer));
+      });
+    }
+    tasks.wait();
+  }
+  if (stats != nullptr)
+  {
+    *options.stats += stats->merge();
+  }
   std::unordered_map<sigscanner::signature, std::vector<sigscanner::offset>> results;
-  this->thread_pool.create(options.thread_count);
-  for (const auto &signature: this->signatures)
+  for (std::size_t i = 0; i < this->signatures.size(); i++)
   {
-    this->thread_pool.add_task([&results, signature, data, len] {
-        results.emplace(signature, signature.scan(data, len, 0));
-    });
+    results.emplace(this->signatures[i], std::move(offsets[i]));
   }
-  this->thread_pool.destroy();
   return results;
 }
 
 std::unordered_map<sigscanner::signature, std::vector<sigscanner::offset>>
 sigscanner::multi_scanner::reverse_scan(const sigscanner::byte *data, std::size_t len, const sigscanner::scan_options &options) const
 {
+  // Each task writes its own slot so no lock is needed
+  std::vector<std::vector<sigscanner::offset>> offsets(this->signatures.size());
+  const std::unique_ptr<sigscanner::stats_shards> stats = options.stats != nullptr ? std::make_unique<sigscanner::stats_shards>(this->signatures.size()) : nullptr;
+  {
+    const std::shared_ptr<sigscanner::thread_pool> pool = this->get_thread_pool(options);
+    sigscanner::scan_limits limits(options);
+    const sigscanner::scan_limits::file_state buffer = limits.start_file();
+    sigscanner::thread_pool::task_group tasks(*pool, stats.get());
+    for (std::size_t i = 0; i < this->signatures.size(); i++)
+    {
+      tasks.add_task([&offsets, &limits, &buffer, &stats, i, data, len, this] {
+          if (limits.skip_file(buffer))
+          {
+            return;
+          }
+          const sigscanner::stats_timer timer(stats.get(), &sigscanner::scan_stats::match_time);
+          if (stats != nullptr)
+          {
+            sigscanner::scan_stats::signature_counts &counts = stats->local().signatures[i];
+            offsets[i] = this->signatures[i].reverse_scan(data, len, 0, limits.match_limit(), counts.candidates);
+            counts.verified += offsets[i].size();
+          } else
+          {
+            offsets[i] = this->signatures[i].reverse_scan(data, len, 0, limits.match_limit());
+          }
+          offsets[i].resize(limits.claim(offsets[i].size(), buffer));
+      });
+    }
+    tasks.wait();
+  }
+  if (stats != nullptr)
+  {
+    *options.stats += stats->merge();
+  }
   std::unordered_map<sigscanner::signature, std::vector<sigscanner::offset>> results;
-  this->thread_pool.create(options.thread_count);
-  for (const auto &signature: this->signatures)
+  for (std::size_t i = 0; i < this->signatures.size(); i++)
   {
-    this->thread_pool.add_task([&results, signature, data, len] {
-        results.emplace(signature, signature.reverse_scan(data, len, 0));
-    });
+    results.emplace(this->signatures[i], std::move(offsets[i]));
   }
-  this->thread_pool.destroy();
   return results;
 }
 
-std::unordered_map<sigscanner::signature, std::vector<sigscanner::offset>> sigscanner::multi_scanner::scan_file(const std::filesystem::path &path, const sigscanner::scan_options &options) const
+std::size_t sigscanner::multi_scanner::scan(const sigscanner::byte *data, std::size_t len, sigscanner::match *out, std::size_t capacity, bool &overflowed) const
 {
-  std::unordered_map<sigscanner::signature, std::vector<sigscanner::offset>> results;
-  for (const auto &signature: this->signatures)
+  std::size_t count = 0;
+  overflowed = false;
+  const auto add = [out, capacity, &count, &overflowed](std::size_t signature, sigscanner::offset offset) {
+      if (count == capacity)
+      {
+        overflowed = true;
+        return false;
+      }
+      out[count++] = {signature, offset, offset};
+      return true;
+  };
+  const auto scan_signature = [this, data, len, &add](std::size_t signature) {
+      return this->signatures[signature].for_each_match(data, len, 0, [signature, &add](sigscanner::offset offset) {
+          return add(signature, offset);
+      });
+  };
+  const std::shared_ptr<const sigscanner::aho_corasick> automaton = this->get_automaton();
+  if (automaton != nullptr)
   {
-    results.emplace(signature, std::vector<sigscanner::offset>());
+    // The automaton can't be stopped, so matches past capacity are only noted
+    automaton->scan(data, len, len, [&add, &overflowed](std::size_t signature, std::size_t pos) {
+        if (!overflowed)
+        {
+          add(signature, pos);
+        }
+    });
+    for (const std::size_t signature: automaton->unkeyed())
+    {
+      if (overflowed || !scan_signature(signature))
+      {
+        break;
+      }
+    }
+    return count;
   }
-  if (!std::filesystem::exists(path) || !std::filesystem::is_regular_file(path))
+  for (std::size_t signature = 0; signature < this->signatures.size(); signature++)
   {
-    return results;
+    if (!scan_signature(signature))
+    {
+      break;
+    }
   }
+  return count;
+}
 
-  const std::size_t longest_sig = this->longest_sig_length();
-  std::unordered_map<sigscanner::signature, std::unordered_map<std::filesystem::path, std::vector<sigscanner::offset>>> file_results;
-  std::mutex file_results_mutex;
-  this->thread_pool.create(options.thread_count);
-  this->scan_file_internal(path, options, longest_sig, file_results, file_results_mutex);
-  this->thread_pool.destroy();
+std::unordered_map<sigscanner::signature, std::vector<sigscanner::offset>> sigscanner::multi_scanner::scan_file(const std::filesystem::path &path, const sigscanner::scan_options &options) const
+{
+  sigscanner::result_shards shards(this->signatures.size());
+  this->scan_paths(path, false, nullptr, [&shards](const std::filesystem::path &match_path, const std::vector<sigscanner::match> &matches) {
+      shards.add(match_path, matches);
+  }, false, options);
 
-  for (auto &[signature, file]: file_results)
+  std::unordered_map<sigscanner::signature, std::vector<sigscanner::offset>> results;
+  for (auto &[signature, file]: shards.merge(this->signatures))
   {
-    assert(file.size() == 1 && "File results should only have one entry");
-    results[signature] = std::move(file.begin()->second);
+    assert(file.size() <= 1 && "File results should only have one entry");
+    results.emplace(signature, file.empty() ? std::vector<sigscanner::offset>() : std::move(file.begin()->second));
   }
-
   return results;
 }
 
 std::unordered_map<sigscanner::signature, std::unordered_map<std::filesystem::path, std::vector<sigscanner::offset>>>
 sigscanner::multi_scanner::scan_directory(const std::filesystem::path &dir, const sigscanner::scan_options &options) const
 {
-  std::unordered_map<sigscanner::signature, std::unordered_map<std::filesystem::path, std::vector<sigscanner::offset>>> results;
-  for (const auto &signature: this->signatures)
+  sigscanner::result_shards shards(this->signatures.size());
+  this->scan_paths(dir, true, nullptr, [&shards](const std::filesystem::path &path, const std::vector<sigscanner::match> &matches) {
+      shards.add(path, matches);
+  }, false, options);
+  return shards.merge(this->signatures);
+}
+
+void sigscanner::multi_scanner::scan_file(const std::filesystem::path &path, const sigscanner::match_sink &sink, const sigscanner::scan_options &options) const
+{
+  this->scan_paths(path, false, nullptr, sink, true, options);
+}
+
+void sigscanner::multi_scanner::scan_directory(const std::filesystem::path &dir, const sigscanner::match_sink &sink, const sigscanner::scan_options &options) const
+{
+  this->scan_paths(dir, true, nullptr, sink, true, options);
+}
+
+std::unordered_map<sigscanner::signature, std::unordered_map<std::filesystem::path, std::vector<sigscanner::offset>>>
+sigscanner::multi_scanner::scan_index(const sigscanner::corpus_index &index, const sigscanner::scan_options &options) const
+{
+  sigscanner::result_shards shards(this->signatures.size());
+  this->scan_paths({}, false, &index, [&shards](const std::filesystem::path &path, const std::vector<sigscanner::match> &matches) {
+      shards.add(path, matches);
+  }, false, options);
+  return shards.merge(this->signatures);
+}
+
+void sigscanner::multi_scanner::scan_index(const sigscanner::corpus_index &index, const sigscanner::match_sink &sink, const sigscanner::scan_options &options) const
+{
+  this->scan_paths({}, false, &index, sink, true, options);
+}
+
+std::unordered_map<sigscanner::signature, std::vector<sigscanner::offset>> sigscanner::multi_scanner::scan_stream(std::istream &stream, const sigscanner::scan_options &options) const
+{
+  sigscanner::result_shards shards(this->signatures.size());
+  this->scan_stream_internal(sigscanner::read_stream(stream), {}, [&shards](const std::filesystem::path &path, const std::vector<sigscanner::match> &matches) {
+      shards.add(path, matches);
+  }, false, options);
+
+  std::unordered_map<sigscanner::signature, std::vector<sigscanner::offset>> results;
+  for (auto &[signature, stream_results]: shards.merge(this->signatures))
+  {
+    results.emplace(signature, stream_results.empty() ? std::vector<sigscanner::offset>() : std::move(stream_results.begin()->second));
+  }
+  return results;
+}
+
+void sigscanner::multi_scanner::scan_stream(std::istream &stream, const sigscanner::match_sink &sink, const sigscanner::scan_options &options) const
+{
+  this->scan_stream_internal(sigscanner::read_stream(stream), {}, sink, true, options);
+}
+
+std::unordered_map<sigscanner::signature, std::vector<sigscanner::offset>> sigscanner::multi_scanner::scan_fd(int fd, const sigscanner::scan_options &options) const
+{
+  sigscanner::result_shards shards(this->signatures.size());
+  this->scan_stream_internal(sigscanner::read_fd(fd), {}, [&shards](const std::filesystem::path &path, const std::vector<sigscanner::match> &matches) {
+      shards.add(path, matches);
+  }, false, options);
+
+  std::unordered_map<sigscanner::signature, std::vector<sigscanner::offset>> results;
+  for (auto &[signature, stream_results]: shards.merge(this->signatures))
+  {
+    results.emplace(signature, stream_results.empty() ? std::vector<sigscanner::offset>() : std::move(stream_results.begin()->second));
+  }
+  return results;
+}
+
+void sigscanner::multi_scanner::scan_fd(int fd, const sigscanner::match_sink &sink, const sigscanner::scan_options &options) const
+{
+  this->scan_stream_internal(sigscanner::read_fd(fd), {}, sink, true, options);
+}
+
+std::unordered_map<sigscanner::signature, std::map<sigscanner::process_region, std::vector<sigscanner::offset>>>
+sigscanner::multi_scanner::scan_process(int pid, const sigscanner::scan_options &options) const
+{
+  std::unordered_map<sigscanner::signature, std::map<sigscanner::process_region, std::vector<sigscanner::offset>>> results;
+  std::vector<std::map<sigscanner::process_region, std::vector<sigscanner::offset>> *> signature_results;
+  for (const sigscanner::signature &signature: this->signatures)
+  {
+    signature_results.push_back(&results[signature]);
+  }
+  this->scan_process(pid, [&signature_results](const sigscanner::process_region &region, const std::vector<sigscanner::match> &matches) {
+      for (const sigscanner::match &match: matches)
+      {
+        (*signature_results[match.signature])[region].push_back(match.offset);
+      }
+  }, options);
+  // Ranges of a region are reported in any order
+  for (auto &[signature, regions]: results)
   {
-    results.emplace(signature, std::unordered_map<std::filesystem::path, std::vector<sigscanner::offset>>());
+    for (auto &[region, addresses]: regions)
+    {
+      std::sort(addresses.begin(), addresses.end());
+    }
   }
-  if (!std::filesystem::exists(dir) || !std::filesystem::is_directory(dir))
+  return results;
+}
+
+bool sigscanner::multi_scanner::scan_process(int pid, const sigscanner::region_sink &sink, const sigscanner::scan_options &options) const
+{
+  // Every process has some mappings, so none means it couldn't be listed
+  const std::vector<sigscanner::process_region> regions = sigscanner::get_process_regions(pid);
+  if (regions.empty())
   {
-    return results;
+    return false;
   }
 
-  std::mutex results_mutex;
-  std::size_t longest_sig = this->longest_sig_length();
-  this->thread_pool.create(options.thread_count);
+  const std::size_t longest_sig = this->longest_sig_length();
+  const std::shared_ptr<const sigscanner::aho_corasick> automaton = this->get_automaton();
+  const std::shared_ptr<sigscanner::thread_pool> pool = this->get_thread_pool(options);
+  const std::unique_ptr<sigscanner::stats_shards> stats = options.stats != nullptr ? std::make_unique<sigscanner::stats_shards>(this->signatures.size()) : nullptr;
+  std::mutex sink_mutex;
+  const sigscanner::region_sink serialized_sink = [&sink, &sink_mutex, &stats](const sigscanner::process_region &region, const std::vector<sigscanner::match> &matches) {
+      std::unique_lock<std::mutex> lock(sink_mutex, std::defer_lock);
+      {
+        const sigscanner::stats_timer timer(stats.get(), &sigscanner::scan_stats::lock_wait_time);
+        lock.lock();
+      }
+      sink(region, matches);
+  };
+  const sigscanner::process_memory memory(pid);
+  sigscanner::scan_limits limits(options);
+  sigscanner::thread_pool::task_group tasks(*pool, stats.get());
 
-  typedef std::filesystem::recursive_directory_iterator recursive_directory_iterator;
-  for (auto it = recursive_directory_iterator(dir); it != recursive_directory_iterator(); it++)
+  // Like small files, small regions are batched, and copied out with one call per batch
+  std::vector<const sigscanner::process_region *> batch;
+  std::uint64_t batch_bytes = 0;
+  const auto queue_batch = [&batch, &batch_bytes, &memory, longest_sig, &automaton, &tasks, &limits, &stats, &serialized_sink, this] {
+      tasks.add_task([batched = std::move(batch), &memory, longest_sig, &automaton, &limits, &stats, &serialized_sink, this] {
+          scan_region_batch(this->signatures, automaton.get(), memory, batched, longest_sig, limits, stats.get(), serialized_sink);
+      });
+      batch = std::vector<const sigscanner::process_region *>();
+      batch_bytes = 0;
+  };
+  for (const sigscanner::process_region &region: regions)
   {
-    if (!options.check_depth(it.depth()))
+    if (limits.stopped())
     {
-      it.disable_recursion_pending();
-      continue;
+      break;
     }
-    if (!it->is_regular_file())
+    if (stats != nullptr)
+    {
+      stats->local().files_visited++;
+    }
+    if (region.permissions.empty() || region.permissions[0] != 'r')
     {
       continue;
     }
-    const std::filesystem::path &path = it->path();
-    if(!options.check_extension(path) || !options.check_filename(path))
+    const std::uint64_t region_size = region.end - region.start;
+    if (region_size <= SIGSCANNER_FILE_BLOCK_SIZE)
     {
+      batch.push_back(&region);
+      batch_bytes += region_size;
+      if (batch_bytes >= SIGSCANNER_FILE_BATCH_SIZE || batch.size() >= sigscanner::process_memory::max_ranges())
+      {
+        queue_batch();
+      }
       continue;
     }
-    this->scan_file_internal(path, options, longest_sig, results, results_mutex);
+    const sigscanner::scan_limits::file_state state = limits.start_file();
+    for (std::uint64_t range_offset = region.start; range_offset < region.end; range_offset += SIGSCANNER_MAPPED_RANGE_SIZE)
+    {
+      // Sized like the ranges of a big file, so bigger regions go first
+      tasks.add_task([&region, range_offset, &memory, longest_sig, &automaton, &limits, &stats, state, &serialized_sink, this] {
+          if (limits.skip_file(state))
+          {
+            return;
+          }
+          if (stats != nullptr && range_offset == region.start)
+          {
+            stats->local().files_scanned++;
+          }
+          const std::uint64_t range_end = std::min(range_offset + SIGSCANNER_MAPPED_RANGE_SIZE, region.end);
+          scan_region_range(this->signatures, automaton.get(), memory, region, range_offset, range_end, longest_sig, limits, state, stats.get(), serialized_sink);
+      }, region.end - range_offset);
+    }
+  }
+  if (!batch.empty())
+  {
+    queue_batch();
+  }
+  tasks.wait();
+  if (stats != nullptr)
+  {
+    *options.stats += stats->merge();
+  }
+  return memory.is_readable();
+}
+
+void sigscanner::multi_scanner::scan_paths(const std::filesystem::path &path, bool directory, const sigscanner::corpus_index *index,
+                                           const sigscanner::match_sink &sink, bool serialize_sink, const sigscanner::scan_options &options) const
+{
+  if (index == nullptr && (!std::filesystem::exists(path) || directory != std::filesystem::is_directory(path)))
+  {
+    return;
+  }
+  if (index == nullptr && !directory && !std::filesystem::is_regular_file(path))
+  {
+    // Pipes and devices can't be sized or read twice
+    std::ifstream stream(path, std::ios::in | std::ios::binary);
+    if (stream.is_open())
+    {
+      this->scan_stream_internal(sigscanner::read_stream(stream), path, sink, serialize_sink, options);
+    }
+    return;
   }
 
-  this->thread_pool.destroy();
+  const std::size_t longest_sig = this->longest_sig_length();
+  const std::shared_ptr<const sigscanner::aho_corasick> automaton = this->get_automaton();
+  const std::shared_ptr<sigscanner::thread_pool> pool = this->get_thread_pool(options);
+  const std::unique_ptr<sigscanner::stats_shards> stats = options.stats != nullptr ? std::make_unique<sigscanner::stats_shards>(this->signatures.size()) : nullptr;
+  std::mutex sink_mutex;
+  const sigscanner::match_sink serialized_sink = [&sink, &sink_mutex, &stats](const std::filesystem::path &match_path, const std::vector<sigscanner::match> &matches) {
+      std::unique_lock<std::mutex> lock(sink_mutex, std::defer_lock);
+      {
+        const sigscanner::stats_timer timer(stats.get(), &sigscanner::scan_stats::lock_wait_time);
+        lock.lock();
+      }
+      sink(match_path, matches);
+  };
+  const sigscanner::match_sink &scan_sink = serialize_sink ? serialized_sink : sink;
+  sigscanner::scan_limits limits(options);
+  sigscanner::block_pool blocks(options.max_bytes_in_flight);
+  sigscanner::thread_pool::task_group tasks(*pool, stats.get());
 
-  return results;
+  std::optional<sigscanner::cache_session> cache;
+  if (options.cache != nullptr && options.elf == scan_options::elf_mode::DISABLED)
+  {
+    cache.emplace(*options.cache, this->signatures);
+  }
+  // Matches of files that are read are also kept for the cache
+  const sigscanner::match_sink recording_sink = [&cache, &scan_sink](const std::filesystem::path &match_path, const std::vector<sigscanner::match> &matches) {
+      cache->record(match_path, matches);
+      scan_sink(match_path, matches);
+  };
+  const sigscanner::match_sink &file_sink = cache ? recording_sink : scan_sink;
+  // Report a file's cached matches instead of reading it. False if it has to be read
+  const auto report_cached = [&cache, &options, &limits, &stats, &scan_sink](const std::filesystem::path &file_path, std::uint64_t file_size) {
+      if (!cache || file_size == 0 || !options.check_file_size(static_cast<std::int64_t>(file_size)))
+      {
+        return false;
+      }
+      thread_local std::vector<sigscanner::match> spare_matches;
+      std::vector<sigscanner::match> matches = std::move(spare_matches);
+      const bool cached = cache->lookup(file_path, matches);
+      if (cached && !limits.stopped())
+      {
+        if (stats != nullptr)
+        {
+          stats->local().files_cached++;
+        }
+        matches.resize(limits.claim(matches.size(), limits.start_file()));
+        if (!matches.empty())
+        {
+          scan_sink(file_path, matches);
+        }
+      }
+      spare_matches = std::move(matches);
+      return cached;
+  };
+
+  if (index != nullptr)
+  {
+    // The ranges of the index are of whole files, so changed files are scanned whole too
+    sigscanner::scan_options whole_files = options;
+    whole_files.elf = scan_options::elf_mode::DISABLED;
+    // Kept until the tasks reading them are done
+    const std::vector<sigscanner::corpus_index::file_ranges> files = index->ranges(this->signatures);
+    for (const sigscanner::corpus_index::file_ranges &file: files)
+    {
+      if (stats != nullptr)
+      {
+        stats->local().files_visited++;
+      }
+      if (report_cached(file.path, file.size))
+      {
+        continue;
+      }
+      if (file.changed)
+      {
+        this->scan_file_internal(file.path, whole_files, longest_sig, automaton.get(), tasks, limits, blocks, stats.get(), file_sink);
+        continue;
+      }
+      if (file.ranges.empty())
+      {
+        continue;
+      }
+      tasks.add_task([&file, longest_sig, &automaton, &limits, &stats, &file_sink, this] {
+          const sigscanner::scan_limits::file_state state = limits.start_file();
+          std::fstream stream(file.path, std::ios::in | std::ios::binary);
+          for (const auto &[begin, end]: file.ranges)
+          {
+            if (limits.skip_file(state))
+            {
+              break;
+            }
+            scan_stream_range(this->signatures, automaton.get(), stream, file.path, file.size, begin, end, longest_sig, limits, state, stats.get(), file_sink);
+          }
+          // scan_chunk only counts a file when it scans its first block
+          if (stats != nullptr && file.ranges.front().first != 0)
+          {
+            stats->local().files_scanned++;
+          }
+      });
+    }
+    tasks.wait();
+    if (cache)
+    {
+      cache->finish(limits, options.first_match_per_file);
+    }
+    if (stats != nullptr)
+    {
+      *options.stats += stats->merge();
+    }
+    return;
+  }
+
+  if (!directory)
+  {
+    if (stats != nullptr)
+    {
+      stats->local().files_visited++;
+    }
+    std::error_code error;
+    const std::uint64_t file_size = std::filesystem::file_size(path, error);
+    if (error || !report_cached(path, file_size))
+    {
+      this->scan_file_internal(path, options, longest_sig, automaton.get(), tasks, limits, blocks, stats.get(), file_sink);
+    }
+    tasks.wait();
+    if (cache)
+    {
+      cache->finish(limits, options.first_match_per_file);
+    }
+    if (stats != nullptr)
+    {
+      *options.stats += stats->merge();
+    }
+    return;
+  }
+
+  /*
+   * Small files don't need a task, stream and buffer each, so they are scanned in batches. Mapping them
+   * wouldn't save anything either, so this is done whatever the read mode
+   */
+  std::optional<sigscanner::file_batches> batches;
+  if (options.threading != scan_options::threading_mode::PER_CHUNK)
+  {
+    batches.emplace(tasks, [&automaton, &options, &limits, &stats, &file_sink, this](const std::vector<sigscanner::file_batches::file> &files) {
+        scan_file_batch(this->signatures, automaton.get(), files, options.elf, options.elf_sections, limits, stats.get(), file_sink);
+    });
+  }
+  // Files are queued as they are found, so scanning starts while the rest of the tree is still being walked
+  sigscanner::directory_walker walker(options, tasks, limits, [&options, longest_sig, &automaton, &tasks, &limits, &blocks, &stats, &file_sink, &batches,
+          &report_cached, this](const std::filesystem::path &file_path, std::uint64_t file_size) {
+      if (stats != nullptr)
+      {
+        stats->local().files_visited++;
+      }
+      if (report_cached(file_path, file_size))
+      {
+        return;
+      }
+      if (batches && file_size <= SIGSCANNER_FILE_BLOCK_SIZE)
+      {
+        if (file_size > 0 && options.check_file_size(static_cast<std::int64_t>(file_size)))
+        {
+          batches->add(file_path, file_size);
+        }
+        return;
+      }
+      this->scan_file_internal(file_path, options, longest_sig, automaton.get(), tasks, limits, blocks, stats.get(), file_sink);
+  });
+  walker.walk(path);
+  if (batches)
+  {
+    // Everything has been found once the walk's tasks are done, so the last batches can't grow any more
+    tasks.wait();
+    batches->flush();
+  }
+  tasks.wait();
+  if (cache)
+  {
+    cache->finish(limits, options.first_match_per_file);
+  }
+  // Every task has counted itself by the time the group is done
+  if (stats != nullptr)
+  {
+    *options.stats += stats->merge();
+  }
+}
+
+void sigscanner::multi_scanner::scan_stream_internal(const sigscanner::stream_reader &read, const std::filesystem::path &path,
+                                                     const sigscanner::match_sink &sink, bool serialize_sink, const sigscanner::scan_options &options) const
+{
+  const std::size_t longest_sig = this->longest_sig_length();
+  const std::shared_ptr<const sigscanner::aho_corasick> automaton = this->get_automaton();
+  const std::shared_ptr<sigscanner::thread_pool> pool = this->get_thread_pool(options);
+  const std::unique_ptr<sigscanner::stats_shards> stats = options.stats != nullptr ? std::make_unique<sigscanner::stats_shards>(this->signatures.size()) : nullptr;
+  std::mutex sink_mutex;
+  const sigscanner::match_sink serialized_sink = [&sink, &sink_mutex, &stats](const std::filesystem::path &match_path, const std::vector<sigscanner::match> &matches) {
+      std::unique_lock<std::mutex> lock(sink_mutex, std::defer_lock);
+      {
+        const sigscanner::stats_timer timer(stats.get(), &sigscanner::scan_stats::lock_wait_time);
+        lock.lock();
+      }
+      sink(match_path, matches);
+  };
+  const sigscanner::match_sink &scan_sink = serialize_sink ? serialized_sink : sink;
+  sigscanner::scan_limits limits(options);
+  sigscanner::block_pool blocks(options.max_bytes_in_flight);
+  sigscanner::thread_pool::task_group tasks(*pool, stats.get());
+  if (stats != nullptr)
+  {
+    stats->local().files_visited++;
+  }
+
+  const sigscanner::scan_limits::file_state state = limits.start_file();
+  // The stream can't be read again, so the end of each chunk is kept to start the next one with
+  std::vector<sigscanner::byte> overlap;
+  overlap.reserve(longest_sig);
+  std::vector<sigscanner::byte> own_chunk;
+  for (std::uint64_t chunk_offset = 0; !limits.skip_file(state);)
+  {
+    // Once every block is queued the chunk is scanned here instead, so reading can't run ahead of the workers
+    sigscanner::byte *block = blocks.try_acquire();
+    if (block == nullptr && own_chunk.empty())
+    {
+      own_chunk.resize(SIGSCANNER_FILE_BLOCK_SIZE);
+    }
+    sigscanner::byte *chunk = block != nullptr ? block : own_chunk.data();
+    std::memcpy(chunk, overlap.data(), overlap.size());
+    std::uint64_t chunk_size;
+    {
+      const sigscanner::stats_timer timer(stats.get(), &sigscanner::scan_stats::read_time);
+      chunk_size = overlap.size() + read(chunk + overlap.size(), SIGSCANNER_FILE_BLOCK_SIZE - overlap.size());
+    }
+    // Only a short read shows the end was reached, a full block might be the last one and is followed by a chunk of just its overlap
+    const bool last_chunk = chunk_size < SIGSCANNER_FILE_BLOCK_SIZE;
+    const std::uint64_t owned_size = last_chunk ? chunk_size : chunk_size - longest_sig;
+    overlap.assign(chunk + owned_size, chunk + chunk_size);
+    if (chunk_size == 0)
+    {
+      if (block != nullptr)
+      {
+        blocks.release(block);
+      }
+      // Without signatures nothing overlaps, so a stream whose size is a multiple of the block size ends with an empty read
+      if (stats != nullptr && chunk_offset == 0)
+      {
+        stats->local().files_skipped++;
+      }
+    } else if (block == nullptr)
+    {
+      scan_chunk(this->signatures, automaton.get(), chunk, chunk_size, chunk_offset, owned_size, path, limits, state, stats.get(), scan_sink);
+    } else
+    {
+      tasks.add_task([&path, &automaton, &limits, &stats, &blocks, state, chunk, chunk_size, chunk_offset, owned_size, &scan_sink, this] {
+          scan_chunk(this->signatures, automaton.get(), chunk, chunk_size, chunk_offset, owned_size, path, limits, state, stats.get(), scan_sink);
+          blocks.release(chunk);
+      });
+    }
+    if (last_chunk)
+    {
+      break;
+    }
+    chunk_offset += owned_size;
+  }
+  tasks.wait();
+  if (stats != nullptr)
+  {
+    *options.stats += stats->merge();
+  }
+}
+
+const std::vector<sigscanner::signature> &sigscanner::multi_scanner::get_signatures() const
+{
+  return this->signatures;
 }
 
 /*
@@ -138,15 +718,358 @@ std::int64_t get_file_size(std::fstream &file)
   return static_cast<std::int64_t>(length);
 }
 
+/*
+ * Chunks overlap by longest_sig bytes so matches spanning a boundary are found. Each chunk only
+ * reports matches starting before the next chunk does, otherwise shorter signatures would be
+ * reported twice.
+ */
+void scan_chunk(const std::vector<sigscanner::signature> &signatures, const sigscanner::aho_corasick *automaton,
+                const sigscanner::byte *chunk, std::uint64_t chunk_size, std::uint64_t chunk_offset, std::uint64_t owned_size,
+                const std::filesystem::path &path, sigscanner::scan_limits &limits, const sigscanner::scan_limits::file_state &state,
+                sigscanner::stats_shards *stats, const sigscanner::match_sink &sink)
+{
+  if (limits.skip_file(state))
+  {
+    return;
+  }
+  const sigscanner::stats_shards::clock::time_point start = stats != nullptr ? sigscanner::stats_shards::clock::now() : sigscanner::stats_shards::clock::time_point();
+  sigscanner::scan_stats::signature_counts *const counts = stats != nullptr ? stats->local().signatures.data() : nullptr;
+  /*
+   * Reuse the worker's batch between chunks rather than growing a new one every time. It is taken
+   * rather than borrowed in case the sink scans something itself
+   */
+  thread_local std::vector<sigscanner::match> spare_matches;
+  std::vector<sigscanner::match> matches = std::move(spare_matches);
+  matches.clear();
+  // Signatures scanned on their own stop once the chunk has as many matches as could be reported
+  const std::size_t limit = limits.match_limit();
+  const auto scan_signature = [&](std::size_t signature) {
+      if (limit != 0 && matches.size() >= limit)
+      {
+        return;
+      }
+      // Straight into the batch, rather than through a vector of offsets per signature
+      const auto add = [&matches, signature, limit](sigscanner::offset offset) {
+          matches.push_back({signature, offset, offset});
+          return limit == 0 || matches.size() < limit;
+      };
+      const std::uint64_t scan_size = std::min<std::uint64_t>(chunk_size, owned_size + signatures[signature].size() - 1);
+      if (counts != nullptr)
+      {
+        const std::size_t found_before = matches.size();
+        signatures[signature].for_each_match(chunk, scan_size, chunk_offset, add, counts[signature].candidates);
+        counts[signature].verified += matches.size() - found_before;
+      } else
+      {
+        signatures[signature].for_each_match(chunk, scan_size, chunk_offset, add);
+      }
+  };
+  if (automaton != nullptr)
+  {
+    automaton->scan(chunk, chunk_size, owned_size, [&matches, chunk_offset](std::size_t signature, std::size_t pos) {
+        matches.push_back({signature, chunk_offset + pos, chunk_offset + pos});
+    }, counts);
+    for (const std::size_t signature: automaton->unkeyed())
+    {
+      scan_signature(signature);
+    }
+  } else
+  {
+    for (std::size_t signature = 0; signature < signatures.size(); signature++)
+    {
+      scan_signature(signature);
+    }
+  }
+  matches.resize(limits.claim(matches.size(), state));
+  if (stats != nullptr)
+  {
+    sigscanner::scan_stats &local = stats->local();
+    local.match_time += sigscanner::stats_shards::clock::now() - start;
+    local.bytes_read += owned_size;
+    // Every file has exactly one chunk starting at 0
+    local.files_scanned += chunk_offset == 0;
+  }
+  // One call per chunk rather than per match keeps the sink's lock out of the scanning loop
+  if (!matches.empty())
+  {
+    sink(path, matches);
+  }
+  spare_matches = std::move(matches);
+}
+
+void scan_file_batch(const std::vector<sigscanner::signature> &signatures, const sigscanner::aho_corasick *automaton,
+                     const std::vector<sigscanner::file_batches::file> &files, sigscanner::scan_options::elf_mode elf,
+                     const std::vector<std::string_view> &elf_sections, sigscanner::scan_limits &limits, sigscanner::stats_shards *stats,
+                     const sigscanner::match_sink &sink)
+{
+  // Every file fits in one block, so each is read whole into the worker's buffer
+  thread_local std::vector<sigscanner::byte> spare_buffer;
+  std::vector<sigscanner::byte> buffer = std::move(spare_buffer);
+  buffer.resize(SIGSCANNER_FILE_BLOCK_SIZE);
+  std::fstream file;
+  for (const sigscanner::file_batches::file &batched: files)
+  {
+    if (limits.stopped())
+    {
+      break;
+    }
+    std::uint64_t size = 0;
+    {
+      const sigscanner::stats_timer timer(stats, &sigscanner::scan_stats::read_time);
+      file.open(batched.path, std::ios::in | std::ios::binary);
+      if (file.is_open())
+      {
+        file.read(reinterpret_cast<char *>(buffer.data()), static_cast<std::streamsize>(std::min(batched.size, SIGSCANNER_FILE_BLOCK_SIZE)));
+        size = static_cast<std::uint64_t>(file.gcount());
+        file.close();
+      }
+      file.clear();
+    }
+    if (size == 0)
+    {
+      continue;
+    }
+    std::optional<std::vector<sigscanner::elf_range>> elf_ranges;
+    if (elf != sigscanner::scan_options::elf_mode::DISABLED)
+    {
+      elf_ranges = sigscanner::find_elf_ranges([&buffer, size](std::uint64_t offset, std::uint64_t length, sigscanner::byte *data) {
+          if (offset > size || length > size - offset)
+          {
+            return false;
+          }
+          std::memcpy(data, buffer.data() + offset, static_cast<std::size_t>(length));
+          return true;
+      }, size, elf, elf_sections);
+    }
+    if (!elf_ranges)
+    {
+      scan_chunk(signatures, automaton, buffer.data(), size, 0, size, batched.path, limits, limits.start_file(), stats, sink);
+      continue;
+    }
+    const sigscanner::scan_limits::file_state state = limits.start_file();
+    // scan_chunk only counts a file when it scans its first block
+    if (stats != nullptr && (elf_ranges->empty() || elf_ranges->front().offset != 0))
+    {
+      stats->local().files_scanned++;
+    }
+    for (const sigscanner::elf_range &range: *elf_ranges)
+    {
+      scan_chunk(signatures, automaton, buffer.data() + range.offset, range.size, range.offset, range.size, batched.path, limits, state, stats,
+                 with_addresses(sink, range.address - range.offset));
+    }
+  }
+  spare_buffer = std::move(buffer);
+}
+
+// Wrap sink so it gets the address each match of an ELF range is loaded at, load_bias being the range's address less its offset
+sigscanner::match_sink with_addresses(const sigscanner::match_sink &sink, std::uint64_t load_bias)
+{
+  return [&sink, load_bias](const std::filesystem::path &path, const std::vector<sigscanner::match> &matches) {
+      // Taken rather than borrowed in case the sink scans something itself
+      thread_local std::vector<sigscanner::match> spare_matches;
+      std::vector<sigscanner::match> addressed = std::move(spare_matches);
+      addressed.assign(matches.begin(), matches.end());
+      for (sigscanner::match &match: addressed)
+      {
+        match.address = match.offset + load_bias;
+      }
+      sink(path, addressed);
+      spare_matches = std::move(addressed);
+  };
+}
+
+/*
+ * Read [range_offset, range_end) of an open file block by block and scan it. Like chunks, the blocks
+ * read up to longest_sig bytes past the range so matches starting in it are found whole.
+ */
+void scan_stream_range(const std::vector<sigscanner::signature> &signatures, const sigscanner::aho_corasick *automaton, std::fstream &file,
+                       const std::filesystem::path &path, std::uint64_t file_size, std::uint64_t range_offset, std::uint64_t range_end, std::size_t longest_sig,
+                       sigscanner::scan_limits &limits, const sigscanner::scan_limits::file_state &state, sigscanner::stats_shards *stats,
+                       const sigscanner::match_sink &sink)
+{
+  thread_local std::vector<sigscanner::byte> spare_chunk;
+  std::vector<sigscanner::byte> chunk = std::move(spare_chunk);
+  chunk.resize(SIGSCANNER_FILE_BLOCK_SIZE);
+  const std::uint64_t scannable_chunk_size = SIGSCANNER_FILE_BLOCK_SIZE - longest_sig;
+  for (std::uint64_t chunk_offset = range_offset; chunk_offset < range_end && !limits.skip_file(state); chunk_offset += scannable_chunk_size)
+  {
+    const std::uint64_t owned_size = std::min(scannable_chunk_size, range_end - chunk_offset);
+    const std::uint64_t chunk_size = std::min<std::uint64_t>(owned_size + longest_sig, file_size - chunk_offset);
+    {
+      const sigscanner::stats_timer timer(stats, &sigscanner::scan_stats::read_time);
+      file.seekg(static_cast<std::streamoff>(chunk_offset));
+      file.read(reinterpret_cast<char *>(chunk.data()), static_cast<std::streamsize>(chunk_size));
+    }
+    if (static_cast<std::uint64_t>(file.gcount()) != chunk_size)
+    {
+      file.clear();
+      break; // Shrunk since it was sized
+    }
+    scan_chunk(signatures, automaton, chunk.data(), chunk_size, chunk_offset, owned_size, path, limits, state, stats, sink);
+  }
+  spare_chunk = std::move(chunk);
+}
+
+/*
+ * Copy [range_offset, range_end) of a region out of the process block by block and scan it, like
+ * scan_stream_range. Pages that can't be read are skipped, along with any match running into them.
+ */
+void scan_region_range(const std::vector<sigscanner::signature> &signatures, const sigscanner::aho_corasick *automaton, const sigscanner::process_memory &memory,
+                       const sigscanner::process_region &region, std::uint64_t range_offset, std::uint64_t range_end, std::size_t longest_sig,
+                       sigscanner::scan_limits &limits, const sigscanner::scan_limits::file_state &state, sigscanner::stats_shards *stats,
+                       const sigscanner::region_sink &sink)
+{
+  // Offsets are already addresses, so the sink only has to add the region
+  const sigscanner::match_sink chunk_sink = [&sink, &region](const std::filesystem::path &, const std::vector<sigscanner::match> &matches) {
+      sink(region, matches);
+  };
+  thread_local std::vector<sigscanner::byte> spare_chunk;
+  std::vector<sigscanner::byte> chunk = std::move(spare_chunk);
+  chunk.resize(SIGSCANNER_FILE_BLOCK_SIZE);
+  const std::uint64_t scannable_chunk_size = SIGSCANNER_FILE_BLOCK_SIZE - longest_sig;
+  std::uint64_t chunk_offset = range_offset;
+  while (chunk_offset < range_end && !limits.skip_file(state) && memory.is_readable())
+  {
+    const std::uint64_t owned_size = std::min(scannable_chunk_size, range_end - chunk_offset);
+    const std::uint64_t chunk_size = std::min<std::uint64_t>(owned_size + longest_sig, region.end - chunk_offset);
+    std::uint64_t read;
+    {
+      const sigscanner::stats_timer timer(stats, &sigscanner::scan_stats::read_time);
+      read = memory.read(chunk_offset, chunk.data(), chunk_size);
+    }
+    if (read >= owned_size)
+    {
+      scan_chunk(signatures, automaton, chunk.data(), read, chunk_offset, owned_size, {}, limits, state, stats, chunk_sink);
+      chunk_offset += owned_size;
+      continue;
+    }
+    if (read > 0)
+    {
+      scan_chunk(signatures, automaton, chunk.data(), read, chunk_offset, read, {}, limits, state, stats, chunk_sink);
+    }
+    const std::uint64_t page_size = sigscanner::process_memory::page_size();
+    chunk_offset = (chunk_offset + read) / page_size * page_size + page_size;
+  }
+  spare_chunk = std::move(chunk);
+}
+
+/*
+ * Copy regions no bigger than a block out of the process in one call and scan each whole. A region
+ * that couldn't be copied is read again on its own, skipping the pages that can't be read.
+ */
+void scan_region_batch(const std::vector<sigscanner::signature> &signatures, const sigscanner::aho_corasick *automaton, const sigscanner::process_memory &memory,
+                       const std::vector<const sigscanner::process_region *> &regions, std::size_t longest_sig, sigscanner::scan_limits &limits,
+                       sigscanner::stats_shards *stats, const sigscanner::region_sink &sink)
+{
+  thread_local std::vector<std::pair<std::uint64_t, std::uint64_t>> ranges;
+  ranges.clear();
+  std::uint64_t total_size = 0;
+  for (const sigscanner::process_region *region: regions)
+  {
+    ranges.emplace_back(region->start, region->end - region->start);
+    total_size += region->end - region->start;
+  }
+  thread_local std::vector<sigscanner::byte> spare_buffer;
+  std::vector<sigscanner::byte> buffer = std::move(spare_buffer);
+  buffer.resize(total_size);
+  std::uint64_t copied;
+  {
+    const sigscanner::stats_timer timer(stats, &sigscanner::scan_stats::read_time);
+    copied = memory.read(ranges, buffer.data());
+  }
+  std::uint64_t position = 0;
+  for (const sigscanner::process_region *region: regions)
+  {
+    if (limits.stopped() || !memory.is_readable())
+    {
+      break;
+    }
+    const std::uint64_t region_size = region->end - region->start;
+    const sigscanner::scan_limits::file_state state = limits.start_file();
+    if (stats != nullptr)
+    {
+      stats->local().files_scanned++;
+    }
+    if (position + region_size <= copied)
+    {
+      scan_chunk(signatures, automaton, buffer.data() + position, region_size, region->start, region_size, {}, limits, state, stats,
+                 [&sink, region](const std::filesystem::path &, const std::vector<sigscanner::match> &matches) {
+                     sink(*region, matches);
+                 });
+    } else
+    {
+      scan_region_range(signatures, automaton, memory, *region, region->start, region->end, longest_sig, limits, state, stats, sink);
+    }
+    position += region_size;
+  }
+  spare_buffer = std::move(buffer);
+}
+
 void sigscanner::multi_scanner::scan_file_internal(
         const std::filesystem::path &path, const sigscanner::scan_options &options, std::size_t longest_sig,
-        std::unordered_map<sigscanner::signature, std::unordered_map<std::filesystem::path, std::vector<sigscanner::offset>>> &results,
-        std::mutex &result_mutex) const
+        const sigscanner::aho_corasick *automaton, sigscanner::thread_pool::task_group &tasks, sigscanner::scan_limits &limits,
+        sigscanner::block_pool &blocks, sigscanner::stats_shards *stats, const sigscanner::match_sink &sink) const
 {
+  const sigscanner::scan_limits::file_state state = limits.start_file();
+  if (options.elf != scan_options::elf_mode::DISABLED && this->scan_elf_file(path, options, longest_sig, automaton, tasks, limits, state, stats, sink))
+  {
+    return;
+  }
   switch (options.threading)
   {
     case scan_options::threading_mode::PER_CHUNK:
     {
+      if (options.read == scan_options::read_mode::MMAP)
+      {
+        auto mapped = std::make_shared<const sigscanner::mapped_file>(path);
+        if (mapped->is_open())
+        {
+          if (options.check_file_size(static_cast<std::int64_t>(mapped->size())))
+          {
+            this->scan_mapped_file(mapped, path, longest_sig, automaton, tasks, limits, state, stats, sink, false);
+          }
+          return;
+        }
+      }
+      if (options.read == scan_options::read_mode::ASYNC)
+      {
+        // Reads ahead on this thread while the queued chunks are scanned
+        thread_local sigscanner::async_reader reader;
+        // Blocks are read in the background, so only the time spent waiting for the next one counts as reading
+        sigscanner::stats_shards::clock::time_point waiting_since = sigscanner::stats_shards::clock::now();
+        const bool read = reader.read_file(path, longest_sig, [&options](std::uint64_t size) {
+            return options.check_file_size(static_cast<std::int64_t>(size));
+        }, [&sink, &path, longest_sig, automaton, &tasks, &limits, stats, &waiting_since, &blocks, &state, this](
+                const sigscanner::byte *data, std::uint64_t size, std::uint64_t offset, bool last) {
+            if (stats != nullptr)
+            {
+              stats->local().read_time += sigscanner::stats_shards::clock::now() - waiting_since;
+            }
+            if (limits.skip_file(state))
+            {
+              return false;
+            }
+            const std::uint64_t owned_size = last ? size : SIGSCANNER_FILE_BLOCK_SIZE - longest_sig;
+            sigscanner::byte *chunk = blocks.try_acquire();
+            if (chunk == nullptr)
+            {
+              scan_chunk(this->signatures, automaton, data, size, offset, owned_size, path, limits, state, stats, sink);
+              waiting_since = sigscanner::stats_shards::clock::now();
+              return !limits.skip_file(state);
+            }
+            std::memcpy(chunk, data, static_cast<std::size_t>(size));
+            tasks.add_task([&sink, &limits, stats, &blocks, state, chunk, size, offset, owned_size, path, automaton, this] {
+                scan_chunk(this->signatures, automaton, chunk, size, offset, owned_size, path, limits, state, stats, sink);
+                blocks.release(chunk);
+            });
+            waiting_since = sigscanner::stats_shards::clock::now();
+            return true;
+        });
+        if (read)
+        {
+          return;
+        }
+      }
       std::fstream file(path, std::ios::in | std::ios::binary);
       file.unsetf(std::ios::skipws);
       const std::int64_t file_size = get_file_size(file);
@@ -155,37 +1078,110 @@ void sigscanner::multi_scanner::scan_file_internal(
         return;
       }
       const std::uint64_t scannable_chunk_size = SIGSCANNER_FILE_BLOCK_SIZE - longest_sig;
-      const std::uint64_t chunk_count = (file_size / scannable_chunk_size) + 1;
-      for (std::uint64_t i = 0; i < chunk_count; i++)
+      // Only used once max_bytes_in_flight are queued, taken rather than borrowed in case the sink scans something itself
+      thread_local std::vector<sigscanner::byte> spare_chunk;
+      std::vector<sigscanner::byte> own_chunk = std::move(spare_chunk);
+      for (std::uint64_t chunk_offset = 0;; chunk_offset += scannable_chunk_size)
       {
-        const std::uint64_t chunk_offset = i * scannable_chunk_size;
         const std::uint64_t chunk_size = std::min(SIGSCANNER_FILE_BLOCK_SIZE, file_size - chunk_offset);
-        std::vector<sigscanner::byte> chunk(chunk_size);
-        const std::fstream::pos_type pos = file.tellg();
-        assert(pos == chunk_offset && "File at incorrect position");
-        file.read(reinterpret_cast<char *>(chunk.data()), static_cast<std::streamsize>(chunk_size));
-        const std::streamsize read = file.gcount();
-        assert(read == chunk_size && "File read failed");
+        const bool last_chunk = chunk_offset + chunk_size == static_cast<std::uint64_t>(file_size);
+        const std::uint64_t owned_size = last_chunk ? chunk_size : scannable_chunk_size;
+        // Once every block is queued the chunk is scanned here instead, so a big file can't be read faster than it is scanned
+        sigscanner::byte *block = blocks.try_acquire();
+        if (block == nullptr && own_chunk.empty())
+        {
+          own_chunk.resize(SIGSCANNER_FILE_BLOCK_SIZE);
+        }
+        sigscanner::byte *chunk = block != nullptr ? block : own_chunk.data();
+        {
+          const sigscanner::stats_timer timer(stats, &sigscanner::scan_stats::read_time);
+          file.read(reinterpret_cast<char *>(chunk), static_cast<std::streamsize>(chunk_size));
+        }
+        // Like scan_stream_range, the rest of a block that wasn't read would be stale data from the block it last held
+        if (static_cast<std::uint64_t>(file.gcount()) != chunk_size)
+        {
+          if (block != nullptr)
+          {
+            blocks.release(block);
+          }
+          break; // Shrunk since it was sized, or failed
+        }
+        if (block == nullptr)
+        {
+          scan_chunk(this->signatures, automaton, chunk, chunk_size, chunk_offset, owned_size, path, limits, state, stats, sink);
+        } else
+        {
+          tasks.add_task([&sink, &limits, stats, &blocks, state, chunk, chunk_size, chunk_offset, owned_size, path, automaton, this] {
+              scan_chunk(this->signatures, automaton, chunk, chunk_size, chunk_offset, owned_size, path, limits, state, stats, sink);
+              blocks.release(chunk);
+          });
+        }
+        if (last_chunk || limits.skip_file(state))
+        {
+          break;
+        }
         file.seekg(-static_cast<std::streamsize>(longest_sig), std::ios::cur);
-        this->thread_pool.add_task([&results, chunk = std::move(chunk), chunk_offset, &result_mutex, &path, this] {
-            for (const auto &signature: this->signatures)
-            {
-              std::vector<sigscanner::offset> offsets = signature.scan(chunk.data(), chunk.size(), chunk_offset);
-              if (!offsets.empty())
-              {
-                std::lock_guard<std::mutex> lock(result_mutex);
-                std::vector<sigscanner::offset> &file_results = results[signature][path];
-                file_results.insert(file_results.end(), offsets.begin(), offsets.end());
-              }
-            }
-        });
       }
       file.close();
+      spare_chunk = std::move(own_chunk);
       break;
     }
+    case scan_options::threading_mode::AUTO:
+    {
+      std::error_code error;
+      const std::uint64_t file_size = std::filesystem::file_size(path, error);
+      if (!error && file_size >= SIGSCANNER_AUTO_SPLIT_SIZE)
+      {
+        if (options.check_file_size(static_cast<std::int64_t>(file_size)))
+        {
+          this->scan_file_ranges(path, file_size, options, longest_sig, automaton, tasks, limits, state, stats, sink);
+        }
+        break;
+      }
+      [[fallthrough]]; // Not worth splitting up
+    }
     case scan_options::threading_mode::PER_FILE:
     {
-      this->thread_pool.add_task([path, longest_sig, &result_mutex, &results, &options, this] {
+      tasks.add_task([path, longest_sig, automaton, &tasks, &limits, stats, state, &sink, &options, this] {
+          if (limits.skip_file(state))
+          {
+            return;
+          }
+          if (options.read == scan_options::read_mode::MMAP)
+          {
+            auto mapped = std::make_shared<const sigscanner::mapped_file>(path);
+            if (mapped->is_open())
+            {
+              if (options.check_file_size(static_cast<std::int64_t>(mapped->size())))
+              {
+                this->scan_mapped_file(mapped, path, longest_sig, automaton, tasks, limits, state, stats, sink, true);
+              }
+              return;
+            }
+          }
+          if (options.read == scan_options::read_mode::ASYNC)
+          {
+            // One reader per worker, setting up io_uring for every file would cost more than it saves
+            thread_local sigscanner::async_reader reader;
+            sigscanner::stats_shards::clock::time_point waiting_since = sigscanner::stats_shards::clock::now();
+            const bool read = reader.read_file(path, longest_sig, [&options](std::uint64_t size) {
+                return options.check_file_size(static_cast<std::int64_t>(size));
+            }, [&sink, &path, longest_sig, automaton, &limits, stats, &waiting_since, &state, this](
+                    const sigscanner::byte *data, std::uint64_t size, std::uint64_t offset, bool last) {
+                if (stats != nullptr)
+                {
+                  stats->local().read_time += sigscanner::stats_shards::clock::now() - waiting_since;
+                }
+                const std::uint64_t owned_size = last ? size : SIGSCANNER_FILE_BLOCK_SIZE - longest_sig;
+                scan_chunk(this->signatures, automaton, data, size, offset, owned_size, path, limits, state, stats, sink);
+                waiting_since = sigscanner::stats_shards::clock::now();
+                return !limits.skip_file(state);
+            });
+            if (read)
+            {
+              return;
+            }
+          }
           std::fstream file(path, std::ios::in | std::ios::binary);
           file.unsetf(std::ios::skipws);
           const std::int64_t file_size = get_file_size(file);
@@ -194,27 +1190,26 @@ void sigscanner::multi_scanner::scan_file_internal(
             return;
           }
           const std::uint64_t scannable_chunk_size = SIGSCANNER_FILE_BLOCK_SIZE - longest_sig;
-          const std::uint64_t chunk_count = (file_size / scannable_chunk_size) + 1;
-          std::vector<sigscanner::byte> chunk(SIGSCANNER_FILE_BLOCK_SIZE);
-          for (std::uint64_t i = 0; i < chunk_count; i++)
+          std::vector<sigscanner::byte> chunk(std::min<std::uint64_t>(SIGSCANNER_FILE_BLOCK_SIZE, file_size));
+          for (std::uint64_t chunk_offset = 0;; chunk_offset += scannable_chunk_size)
           {
-            const std::uint64_t chunk_offset = i * scannable_chunk_size;
             const std::uint64_t chunk_size = std::min(SIGSCANNER_FILE_BLOCK_SIZE, file_size - chunk_offset);
-            std::fstream::pos_type pos = file.tellg();
-            assert(pos == chunk_offset && "File at incorrect position");
-            file.read(reinterpret_cast<char *>(chunk.data()), static_cast<std::streamsize>(chunk_size));
-            assert(file.gcount() == chunk_size && "File read failed");
-            file.seekg(-static_cast<std::streamsize>(longest_sig), std::ios::cur);
-            for (const auto &signature: this->signatures)
+            const bool last_chunk = chunk_offset + chunk_size == static_cast<std::uint64_t>(file_size);
+            const std::uint64_t owned_size = last_chunk ? chunk_size : scannable_chunk_size;
             {
-              std::vector<sigscanner::offset> offsets = signature.scan(chunk.data(), chunk.size(), chunk_offset);
-              if (!offsets.empty())
-              {
-                std::lock_guard<std::mutex> lock(result_mutex);
-                std::vector<sigscanner::offset> &file_results = results[signature][path];
-                file_results.insert(file_results.end(), offsets.begin(), offsets.end());
-              }
+              const sigscanner::stats_timer timer(stats, &sigscanner::scan_stats::read_time);
+              file.read(reinterpret_cast<char *>(chunk.data()), static_cast<std::streamsize>(chunk_size));
+            }
+            if (static_cast<std::uint64_t>(file.gcount()) != chunk_size)
+            {
+              break; // Shrunk since it was sized, or failed
+            }
+            scan_chunk(this->signatures, automaton, chunk.data(), chunk_size, chunk_offset, owned_size, path, limits, state, stats, sink);
+            if (last_chunk || limits.skip_file(state))
+            {
+              break;
             }
+            file.seekg(-static_cast<std::streamsize>(longest_sig), std::ios::cur);
           }
       });
       break;
@@ -222,9 +1217,219 @@ void sigscanner::multi_scanner::scan_file_internal(
   }
 }
 
+void sigscanner::multi_scanner::scan_mapped_file(
+        const std::shared_ptr<const sigscanner::mapped_file> &file, const std::filesystem::path &path, std::size_t longest_sig,
+        const sigscanner::aho_corasick *automaton, sigscanner::thread_pool::task_group &tasks, sigscanner::scan_limits &limits,
+        const sigscanner::scan_limits::file_state &state, sigscanner::stats_shards *stats, const sigscanner::match_sink &sink, bool scan_first) const
+{
+  const auto scan_range = [file, path, longest_sig, automaton, &limits, stats, state, &sink, this](std::uint64_t range_offset) {
+      if (limits.skip_file(state))
+      {
+        return; // Don't fault in the rest of the file
+      }
+      const std::uint64_t owned_size = std::min(SIGSCANNER_MAPPED_RANGE_SIZE, file->size() - range_offset);
+      const std::uint64_t range_size = std::min<std::uint64_t>(owned_size + longest_sig, file->size() - range_offset);
+      file->will_need(range_offset, range_size);
+      scan_chunk(this->signatures, automaton, file->data() + range_offset, range_size, range_offset, owned_size, path, limits, state, stats, sink);
+  };
+
+  // Queue the other ranges before scanning the first so idle workers can start on them
+  for (std::uint64_t range_offset = scan_first ? SIGSCANNER_MAPPED_RANGE_SIZE : 0; range_offset < file->size(); range_offset += SIGSCANNER_MAPPED_RANGE_SIZE)
+  {
+    tasks.add_task([scan_range, range_offset] {
+        scan_range(range_offset);
+    });
+  }
+  if (scan_first)
+  {
+    scan_range(0);
+  }
+}
+
+void sigscanner::multi_scanner::scan_file_ranges(
+        const std::filesystem::path &path, std::uint64_t file_size, const sigscanner::scan_options &options, std::size_t longest_sig,
+        const sigscanner::aho_corasick *automaton, sigscanner::thread_pool::task_group &tasks, sigscanner::scan_limits &limits,
+        const sigscanner::scan_limits::file_state &state, sigscanner::stats_shards *stats, const sigscanner::match_sink &sink) const
+{
+  std::shared_ptr<const sigscanner::mapped_file> mapped;
+  if (options.read == scan_options::read_mode::MMAP)
+  {
+    mapped = std::make_shared<const sigscanner::mapped_file>(path);
+    if (mapped->is_open())
+    {
+      file_size = mapped->size();
+    } else
+    {
+      mapped = nullptr;
+    }
+  }
+
+  for (std::uint64_t range_offset = 0; range_offset < file_size; range_offset += SIGSCANNER_MAPPED_RANGE_SIZE)
+  {
+    // Sized by what is left of the file, so bigger files go first and a file's ranges are taken in order
+    tasks.add_task([mapped, path, file_size, range_offset, longest_sig, automaton, &limits, stats, state, &sink, this] {
+        if (limits.skip_file(state))
+        {
+          return;
+        }
+        const std::uint64_t range_end = std::min(range_offset + SIGSCANNER_MAPPED_RANGE_SIZE, file_size);
+        if (mapped != nullptr)
+        {
+          const std::uint64_t owned_size = range_end - range_offset;
+          const std::uint64_t range_size = std::min<std::uint64_t>(owned_size + longest_sig, file_size - range_offset);
+          mapped->will_need(range_offset, range_size);
+          scan_chunk(this->signatures, automaton, mapped->data() + range_offset, range_size, range_offset, owned_size, path, limits, state, stats, sink);
+          return;
+        }
+
+        std::fstream file(path, std::ios::in | std::ios::binary);
+        scan_stream_range(this->signatures, automaton, file, path, file_size, range_offset, range_end, longest_sig, limits, state, stats, sink);
+    }, file_size - range_offset);
+  }
+}
+
+bool sigscanner::multi_scanner::scan_elf_file(
+        const std::filesystem::path &path, const sigscanner::scan_options &options, std::size_t longest_sig,
+        const sigscanner::aho_corasick *automaton, sigscanner::thread_pool::task_group &tasks, sigscanner::scan_limits &limits,
+        const sigscanner::scan_limits::file_state &state, sigscanner::stats_shards *stats, const sigscanner::match_sink &sink) const
+{
+  std::error_code error;
+  const std::uint64_t file_size = std::filesystem::file_size(path, error);
+  // Left to the usual path, which skips them
+  if (error || file_size == 0 || !options.check_file_size(static_cast<std::int64_t>(file_size)))
+  {
+    return false;
+  }
+  std::optional<std::vector<sigscanner::elf_range>> ranges;
+  {
+    const sigscanner::stats_timer timer(stats, &sigscanner::scan_stats::read_time);
+    std::fstream file(path, std::ios::in | std::ios::binary);
+    if (!file.is_open())
+    {
+      return false;
+    }
+    ranges = sigscanner::find_elf_ranges([&file](std::uint64_t offset, std::uint64_t length, sigscanner::byte *data) {
+        file.seekg(static_cast<std::streamoff>(offset));
+        file.read(reinterpret_cast<char *>(data), static_cast<std::streamsize>(length));
+        const bool read = static_cast<std::uint64_t>(file.gcount()) == length;
+        file.clear();
+        return read;
+    }, file_size, options.elf, options.elf_sections);
+  }
+  if (!ranges)
+  {
+    return false;
+  }
+  // scan_chunk only counts a file when it scans its first block
+  if (stats != nullptr && (ranges->empty() || ranges->front().offset != 0))
+  {
+    stats->local().files_scanned++;
+  }
+
+  std::shared_ptr<const sigscanner::mapped_file> mapped;
+  if (options.read == scan_options::read_mode::MMAP)
+  {
+    mapped = std::make_shared<const sigscanner::mapped_file>(path);
+    if (!mapped->is_open() || mapped->size() != file_size)
+    {
+      mapped = nullptr;
+    }
+  }
+  // Small sections like .init and .plt share a task, big ones are split up like big files
+  struct piece
+  {
+      std::uint64_t offset;
+      std::uint64_t end;
+      std::uint64_t range_end; // Matches can't run past the end of their range
+      std::uint64_t load_bias;
+  };
+  std::vector<piece> pieces;
+  std::uint64_t piece_bytes = 0;
+  const auto queue_pieces = [&pieces, &piece_bytes, &mapped, &path, longest_sig, automaton, &tasks, &limits, stats, &state, &sink, this] {
+      tasks.add_task([pieces = std::move(pieces), mapped, path, longest_sig, automaton, &limits, stats, state, &sink, this] {
+          std::fstream file;
+          for (const piece &piece: pieces)
+          {
+            if (limits.skip_file(state))
+            {
+              return;
+            }
+            const sigscanner::match_sink range_sink = with_addresses(sink, piece.load_bias);
+            if (mapped != nullptr)
+            {
+              const std::uint64_t owned_size = piece.end - piece.offset;
+              const std::uint64_t piece_size = std::min<std::uint64_t>(owned_size + longest_sig, piece.range_end - piece.offset);
+              mapped->will_need(piece.offset, piece_size);
+              scan_chunk(this->signatures, automaton, mapped->data() + piece.offset, piece_size, piece.offset, owned_size, path, limits, state, stats, range_sink);
+              continue;
+            }
+            if (!file.is_open())
+            {
+              file.open(path, std::ios::in | std::ios::binary);
+            }
+            scan_stream_range(this->signatures, automaton, file, path, piece.range_end, piece.offset, piece.end, longest_sig, limits, state, stats, range_sink);
+          }
+      }, piece_bytes);
+      pieces = std::vector<piece>();
+      piece_bytes = 0;
+  };
+  for (const sigscanner::elf_range &range: *ranges)
+  {
+    for (std::uint64_t offset = range.offset; offset < range.offset + range.size; offset += SIGSCANNER_MAPPED_RANGE_SIZE)
+    {
+      const std::uint64_t end = std::min(offset + SIGSCANNER_MAPPED_RANGE_SIZE, range.offset + range.size);
+      pieces.push_back({offset, end, range.offset + range.size, range.address - range.offset});
+      piece_bytes += end - offset;
+      if (piece_bytes >= SIGSCANNER_MAPPED_RANGE_SIZE)
+      {
+        queue_pieces();
+      }
+    }
+  }
+  if (!pieces.empty())
+  {
+    queue_pieces();
+  }
+  return true;
+}
+
 std::size_t sigscanner::multi_scanner::longest_sig_length() const
 {
+  if (this->signatures.empty())
+  {
+    return 0;
+  }
   return std::max_element(this->signatures.begin(), this->signatures.end(), [](const sigscanner::signature &a, const sigscanner::signature &b) {
       return a.size() < b.size();
   })->size();
 }
+
+std::shared_ptr<const sigscanner::aho_corasick> sigscanner::multi_scanner::get_automaton() const
+{
+  if (this->signatures.size() < SIGSCANNER_AUTOMATON_MIN_SIGNATURES)
+  {
+    return nullptr;
+  }
+  std::lock_guard<std::mutex> lock(this->automaton_mutex);
+  if (!this->automaton)
+  {
+    this->automaton = std::make_shared<const sigscanner::aho_corasick>(this->signatures);
+  }
+  return this->automaton;
+}
+
+std::shared_ptr<sigscanner::thread_pool> sigscanner::multi_scanner::get_thread_pool(const sigscanner::scan_options &options) const
+{
+  if (options.pool)
+  {
+    return options.pool;
+  }
+  const std::size_t thread_count = std::max<std::size_t>(options.thread_count, 1);
+  std::lock_guard<std::mutex> lock(this->pool_mutex);
+  // Scans still running on the old pool keep it alive until they finish
+  if (!this->owned_pool || this->owned_pool->size() != thread_count)
+  {
+    this->owned_pool = std::make_shared<sigscanner::thread_pool>(thread_count);
+  }
+  return this->owned_pool;
+}
@@ -0,0 +1,138 @@
+#include "process_memory.hpp"
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+
+#ifdef __linux__
+#include <sys/uio.h>
+#include <unistd.h>
+#include <cerrno>
+#include <climits>
+#endif
+
+bool sigscanner::process_region::operator<(const sigscanner::process_region &other) const
+{
+  return this->start < other.start;
+}
+
+std::vector<sigscanner::process_region> sigscanner::get_process_regions(int pid)
+{
+  std::vector<sigscanner::process_region> regions;
+#ifdef __linux__
+  std::ifstream maps("/proc/" + std::to_string(pid) + "/maps");
+  std::string line;
+  while (std::getline(maps, line))
+  {
+    // start-end perms offset device inode name, where the name may contain spaces or be missing
+    std::istringstream fields(line);
+    std::string range;
+    std::string device;
+    std::uint64_t inode = 0;
+    sigscanner::process_region region;
+    fields >> range >> region.permissions >> std::hex >> region.file_offset >> device >> std::dec >> inode;
+    const std::size_t separator = range.find('-');
+    if (!fields || separator == std::string::npos)
+    {
+      continue;
+    }
+    region.start = std::stoull(range.substr(0, separator), nullptr, 16);
+    region.end = std::stoull(range.substr(separator + 1), nullptr, 16);
+    std::getline(fields >> std::ws, region.name);
+    if (region.end > region.start)
+    {
+      regions.push_back(std::move(region));
+    }
+  }
+#else
+  (void) pid;
+#endif
+  std::sort(regions.begin(), regions.end());
+  return regions;
+}
+
+sigscanner::process_memory::process_memory(int pid) : pid(pid)
+{
+}
+
+bool sigscanner::process_memory::is_readable() const
+{
+  return this->readable.load(std::memory_order_relaxed);
+}
+
+#ifdef __linux__
+
+std::uint64_t sigscanner::process_memory::read(std::uint64_t address, sigscanner::byte *buffer, std::uint64_t size) const
+{
+  // The kernel copies up to the first page it can't read and reports that, so retrying from there tells whether that page is the end
+  std::uint64_t done = 0;
+  while (done < size)
+  {
+    const iovec local{buffer + done, static_cast<std::size_t>(size - done)};
+    const iovec remote{reinterpret_cast<void *>(static_cast<std::uintptr_t>(address + done)), static_cast<std::size_t>(size - done)};
+    const ssize_t read = process_vm_readv(this->pid, &local, 1, &remote, 1, 0);
+    if (read < 0 && errno != EFAULT)
+    {
+      this->readable.store(false, std::memory_order_relaxed);
+    }
+    if (read <= 0)
+    {
+      break;
+    }
+    done += static_cast<std::uint64_t>(read);
+  }
+  return done;
+}
+
+std::uint64_t sigscanner::process_memory::read(const std::vector<std::pair<std::uint64_t, std::uint64_t>> &ranges, sigscanner::byte *buffer) const
+{
+  thread_local std::vector<iovec> remote;
+  remote.clear();
+  std::uint64_t total = 0;
+  for (const auto &[address, size]: ranges)
+  {
+    remote.push_back({reinterpret_cast<void *>(static_cast<std::uintptr_t>(address)), static_cast<std::size_t>(size)});
+    total += size;
+  }
+  const iovec local{buffer, static_cast<std::size_t>(total)};
+  const ssize_t read = process_vm_readv(this->pid, &local, 1, remote.data(), static_cast<unsigned long>(remote.size()), 0);
+  if (read < 0 && errno != EFAULT)
+  {
+    this->readable.store(false, std::memory_order_relaxed);
+  }
+  return read > 0 ? static_cast<std::uint64_t>(read) : 0;
+}
+
+std::uint64_t sigscanner::process_memory::page_size()
+{
+  static const auto size = static_cast<std::uint64_t>(sysconf(_SC_PAGESIZE));
+  return size;
+}
+
+std::size_t sigscanner::process_memory::max_ranges()
+{
+  return IOV_MAX;
+}
+
+#else
+
+std::uint64_t sigscanner::process_memory::read(std::uint64_t, sigscanner::byte *, std::uint64_t) const
+{
+  return 0;
+}
+
+std::uint64_t sigscanner::process_memory::read(const std::vector<std::pair<std::uint64_t, std::uint64_t>> &, sigscanner::byte *) const
+{
+  return 0;
+}
+
+std::uint64_t sigscanner::process_memory::page_size()
+{
+  return 4096;
+}
+
+std::size_t sigscanner::process_memory::max_ranges()
+{
+  return 1;
+}
+
+#endif
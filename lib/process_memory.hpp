@@ -0,0 +1,42 @@
+#pragma once
+
+#include "sigscanner/sigscanner.hpp"
+
+namespace sigscanner
+{
+    /*
+     * Reads the memory of another process with process_vm_readv, without stopping or attaching to it.
+     * Needs the same permission as ptrace. Linux only, elsewhere every read fails.
+     */
+    class process_memory
+    {
+    public:
+        explicit process_memory(int pid);
+
+        /*
+         * Copy [address, address + size) into buffer. Returns how many bytes from address on could be
+         * read, which is less than size if a page in between can't be, for example a mapped file's
+         * pages past its end.
+         */
+        std::uint64_t read(std::uint64_t address, byte *buffer, std::uint64_t size) const;
+
+        /*
+         * Copy several ranges back to back into buffer with a single call. Returns how many bytes were
+         * copied before the first one that couldn't be read whole, read() the rest to find out more.
+         */
+        std::uint64_t read(const std::vector<std::pair<std::uint64_t, std::uint64_t>> &ranges, byte *buffer) const;
+
+        /*
+         * False once a read failed for the whole process rather than for a page, because it exited or
+         * may not be read, so there is no point trying the rest of its pages.
+         */
+        bool is_readable() const;
+
+        static std::uint64_t page_size();
+        static std::size_t max_ranges(); // Most ranges a single read can take
+
+    private:
+        const int pid;
+        mutable std::atomic<bool> readable = true;
+    };
+}
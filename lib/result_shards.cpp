@@ -0,0 +1,60 @@
+#include "result_shards.hpp"
+#include <algorithm>
+
+sigscanner::result_shards::result_shards(std::size_t signature_count)
+        : signature_count(signature_count), shards([signature_count] { return shard(signature_count); })
+{
+}
+
+void sigscanner::result_shards::add(const std::filesystem::path &path, const std::vector<sigscanner::match> &matches)
+{
+  shard &local = this->shards.local();
+  // Matches of a signature are usually next to each other, so look it up once for each run
+  for (std::size_t start = 0, end; start < matches.size(); start = end)
+  {
+    const std::size_t signature = matches[start].signature;
+    for (end = start + 1; end < matches.size() && matches[end].signature == signature; end++);
+    std::vector<sigscanner::offset> &offsets = local[signature][path];
+    for (std::size_t i = start; i < end; i++)
+    {
+      offsets.push_back(matches[i].offset);
+    }
+  }
+}
+
+std::unordered_map<sigscanner::signature, std::unordered_map<std::filesystem::path, std::vector<sigscanner::offset>>>
+sigscanner::result_shards::merge(const std::vector<sigscanner::signature> &signatures)
+{
+  std::unordered_map<sigscanner::signature, std::unordered_map<std::filesystem::path, std::vector<sigscanner::offset>>> results;
+  for (const auto &signature: signatures)
+  {
+    results.emplace(signature, std::unordered_map<std::filesystem::path, std::vector<sigscanner::offset>>());
+  }
+  for (std::size_t signature = 0; signature < this->signature_count; signature++)
+  {
+    std::unordered_map<std::filesystem::path, std::vector<sigscanner::offset>> &files = results[signatures[signature]];
+    for (shard &shard: this->shards)
+    {
+      for (auto &[path, offsets]: shard[signature])
+      {
+        std::vector<sigscanner::offset> &merged = files[path];
+        if (merged.empty())
+        {
+          merged = std::move(offsets);
+        } else
+        {
+          merged.insert(merged.end(), offsets.begin(), offsets.end());
+        }
+      }
+    }
+    // Chunks of a file are scanned in any order and on any thread, but single threaded scans have always returned offsets ascending
+    for (auto &[path, offsets]: files)
+    {
+      if (!std::is_sorted(offsets.begin(), offsets.end()))
+      {
+        std::sort(offsets.begin(), offsets.end());
+      }
+    }
+  }
+  return results;
+}
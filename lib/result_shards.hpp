@@ -0,0 +1,32 @@
+#pragma once
+
+#include "sigscanner/sigscanner.hpp"
+#include "thread_shards.hpp"
+
+namespace sigscanner
+{
+    /*
+     * Collects matches into one shard per thread, so workers never wait on each other to record a
+     * match. The shards are merged once when the scan has finished.
+     */
+    class result_shards
+    {
+    public:
+        explicit result_shards(std::size_t signature_count);
+        result_shards(const result_shards &copy) = delete;
+        result_shards &operator=(const result_shards &copy) = delete;
+
+        // Safe to call from any number of threads at once
+        void add(const std::filesystem::path &path, const std::vector<match> &matches);
+
+        // Each file's offsets come out ascending. Must not be called while matches are still being added
+        std::unordered_map<signature, std::unordered_map<std::filesystem::path, std::vector<offset>>> merge(const std::vector<signature> &signatures);
+
+    private:
+        // Offsets of signature i in a file are shard[i][path]
+        typedef std::vector<std::unordered_map<std::filesystem::path, std::vector<offset>>> shard;
+
+        const std::size_t signature_count;
+        thread_shards<shard> shards;
+    };
+}
@@ -0,0 +1,302 @@
+#include "sigscanner/sigscanner.hpp"
+#include "mapped_file.hpp"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <random>
+#include <sstream>
+#include <tuple>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/*
+ * The file is a header, then every record sorted by key, then the matches of each record in the same
+ * order. Everything is 8 byte aligned so the records and matches can be used straight from the mapping.
+ */
+struct sigscanner::scan_cache::record
+{
+  key file;
+  std::uint64_t first_match; // Index into the matches
+  std::uint64_t match_count;
+};
+
+struct sigscanner::scan_cache::stored_match
+{
+  std::uint64_t signature;
+  std::uint64_t offset;
+};
+
+namespace
+{
+  struct header
+  {
+      std::array<char, 8> magic;
+      std::uint32_t version;
+      std::uint32_t byte_order; // Written natively, so caches from a machine of the other byte order aren't loaded
+      std::uint64_t record_count;
+      std::uint64_t match_count;
+  };
+
+  constexpr std::array<char, 8> cache_magic = {'S', 'I', 'G', 'C', 'A', 'C', 'H', 'E'};
+  constexpr std::uint32_t cache_version = 1;
+  constexpr std::uint32_t cache_byte_order = 0x01020304;
+}
+
+sigscanner::scan_cache::scan_cache(std::filesystem::path path) : path(std::move(path))
+{
+  static_assert(sizeof(header) == 32 && sizeof(record) == 56 && sizeof(stored_match) == 16, "Cache layout changed, bump cache_version");
+  this->load();
+}
+
+sigscanner::scan_cache::~scan_cache() = default;
+
+bool sigscanner::scan_cache::key::operator<(const sigscanner::scan_cache::key &other) const
+{
+  return std::tie(this->signature_set, this->device, this->inode, this->size, this->modified)
+         < std::tie(other.signature_set, other.device, other.inode, other.size, other.modified);
+}
+
+bool sigscanner::scan_cache::key::operator==(const sigscanner::scan_cache::key &other) const
+{
+  return this->signature_set == other.signature_set && this->device == other.device && this->inode == other.inode
+         && this->size == other.size && this->modified == other.modified;
+}
+
+std::uint64_t sigscanner::scan_cache::hash_signatures(const std::vector<sigscanner::signature> &signatures)
+{
+  // Matches refer to signatures by index, so the order is part of the hash
+  std::uint64_t hash = signatures.size();
+  for (const sigscanner::signature &signature: signatures)
+  {
+    hash = (hash ^ std::hash<sigscanner::signature>{}(signature)) * 0x100000001b3ull;
+  }
+  return hash;
+}
+
+#ifdef _WIN32
+
+std::optional<sigscanner::scan_cache::key> sigscanner::scan_cache::identify(const std::filesystem::path &path, std::uint64_t signature_set)
+{
+  HANDLE file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, 0, nullptr);
+  if (file == INVALID_HANDLE_VALUE)
+  {
+    return std::nullopt;
+  }
+  BY_HANDLE_FILE_INFORMATION info;
+  const bool identified = GetFileType(file) == FILE_TYPE_DISK && GetFileInformationByHandle(file, &info);
+  CloseHandle(file);
+  if (!identified || (info.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0)
+  {
+    return std::nullopt;
+  }
+  return key{signature_set, info.dwVolumeSerialNumber,
+             (static_cast<std::uint64_t>(info.nFileIndexHigh) << 32) | info.nFileIndexLow,
+             (static_cast<std::uint64_t>(info.nFileSizeHigh) << 32) | info.nFileSizeLow,
+             static_cast<std::int64_t>((static_cast<std::uint64_t>(info.ftLastWriteTime.dwHighDateTime) << 32) | info.ftLastWriteTime.dwLowDateTime)};
+}
+
+#else
+
+std::optional<sigscanner::scan_cache::key> sigscanner::scan_cache::identify(const std::filesystem::path &path, std::uint64_t signature_set)
+{
+  // Opened rather than just stat'd so files that can't be read aren't cached as having no matches
+  const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+  {
+    return std::nullopt;
+  }
+  struct stat st{};
+  const bool identified = fstat(fd, &st) == 0 && S_ISREG(st.st_mode);
+  close(fd);
+  if (!identified)
+  {
+    return std::nullopt;
+  }
+#ifdef __APPLE__
+  const struct timespec &modified = st.st_mtimespec;
+#else
+  const struct timespec &modified = st.st_mtim;
+#endif
+  return key{signature_set, static_cast<std::uint64_t>(st.st_dev), static_cast<std::uint64_t>(st.st_ino), static_cast<std::uint64_t>(st.st_size),
+             static_cast<std::int64_t>(modified.tv_sec) * 1'000'000'000 + modified.tv_nsec};
+}
+
+#endif
+
+bool sigscanner::scan_cache::find(const sigscanner::scan_cache::key &file, std::vector<sigscanner::match> &found)
+{
+  {
+    std::lock_guard<std::mutex> lock(this->added_mutex);
+    const auto added_file = this->added.find(file);
+    if (added_file != this->added.end())
+    {
+      found = added_file->second;
+      return true;
+    }
+  }
+  const record *end = this->records + this->record_count;
+  const record *loaded = std::lower_bound(this->records, end, file, [](const record &a, const key &b) {
+      return a.file < b;
+  });
+  if (loaded == end || !(loaded->file == file) || !this->in_range(*loaded))
+  {
+    return false;
+  }
+  this->used[loaded - this->records].store(true, std::memory_order_relaxed);
+  found.clear();
+  for (const stored_match *match = this->matches + loaded->first_match; match != this->matches + loaded->first_match + loaded->match_count; match++)
+  {
+    found.push_back({static_cast<std::size_t>(match->signature), match->offset, match->offset});
+  }
+  return true;
+}
+
+bool sigscanner::scan_cache::in_range(const sigscanner::scan_cache::record &loaded) const
+{
+  // Loading only checks the counts in the header, checking every record would mean reading all of them
+  return loaded.first_match <= this->match_count && loaded.match_count <= this->match_count - loaded.first_match;
+}
+
+void sigscanner::scan_cache::add(const sigscanner::scan_cache::key &file, std::vector<sigscanner::match> &&file_matches)
+{
+  std::lock_guard<std::mutex> lock(this->added_mutex);
+  this->added[file] = std::move(file_matches);
+}
+
+void sigscanner::scan_cache::load()
+{
+  auto mapped = std::make_unique<const sigscanner::mapped_file>(this->path);
+  if (!mapped->is_open() || mapped->size() < sizeof(header))
+  {
+    return;
+  }
+  header head{};
+  std::memcpy(&head, mapped->data(), sizeof(header));
+  if (head.magic != cache_magic || head.version != cache_version || head.byte_order != cache_byte_order)
+  {
+    return;
+  }
+  // Compared by division so corrupt counts can't overflow
+  const std::uint64_t available = mapped->size() - sizeof(header);
+  if (head.record_count > available / sizeof(record) || (available - head.record_count * sizeof(record)) / sizeof(stored_match) != head.match_count
+      || (available - head.record_count * sizeof(record)) % sizeof(stored_match) != 0)
+  {
+    return;
+  }
+  this->records = reinterpret_cast<const record *>(mapped->data() + sizeof(header));
+  this->record_count = static_cast<std::size_t>(head.record_count);
+  this->matches = reinterpret_cast<const stored_match *>(this->records + this->record_count);
+  this->match_count = static_cast<std::size_t>(head.match_count);
+  this->used = std::make_unique<std::atomic<bool>[]>(this->record_count);
+  this->mapping = std::move(mapped);
+}
+
+void sigscanner::scan_cache::unload()
+{
+  this->mapping.reset();
+  this->records = nullptr;
+  this->record_count = 0;
+  this->matches = nullptr;
+  this->match_count = 0;
+  this->used.reset();
+}
+
+bool sigscanner::scan_cache::save(bool keep_unused)
+{
+  std::lock_guard<std::mutex> lock(this->added_mutex);
+  struct entry
+  {
+      const key *file;
+      const record *loaded; // Either this or added is set
+      const std::vector<match> *added;
+  };
+  std::vector<entry> entries;
+  entries.reserve(this->record_count + this->added.size());
+  for (std::size_t i = 0; i < this->record_count; i++)
+  {
+    const record &loaded = this->records[i];
+    if ((!keep_unused && !this->used[i].load(std::memory_order_relaxed)) || !this->in_range(loaded))
+    {
+      continue;
+    }
+    // A file scanned again since has changed, so this result is stale
+    const auto newer = this->added.lower_bound({loaded.file.signature_set, loaded.file.device, loaded.file.inode, 0, std::numeric_limits<std::int64_t>::min()});
+    if (newer != this->added.end() && newer->first.signature_set == loaded.file.signature_set && newer->first.device == loaded.file.device
+        && newer->first.inode == loaded.file.inode)
+    {
+      continue;
+    }
+    entries.push_back({&loaded.file, &loaded, nullptr});
+  }
+  for (const auto &[file, file_matches]: this->added)
+  {
+    entries.push_back({&file, nullptr, &file_matches});
+  }
+  std::sort(entries.begin(), entries.end(), [](const entry &a, const entry &b) {
+      return *a.file < *b.file;
+  });
+
+  header head{cache_magic, cache_version, cache_byte_order, entries.size(), 0};
+  for (const entry &entry: entries)
+  {
+    head.match_count += entry.loaded != nullptr ? entry.loaded->match_count : entry.added->size();
+  }
+  // Next to the cache so the rename can't cross file systems, and unique so processes saving at once don't share one
+  std::ostringstream temp_name;
+  temp_name << this->path.filename().string() << ".tmp-" << std::hex << std::random_device{}() << std::random_device{}();
+  const std::filesystem::path temp_path = this->path.parent_path() / temp_name.str();
+  {
+    std::ofstream out(temp_path, std::ios::out | std::ios::binary | std::ios::trunc);
+    out.write(reinterpret_cast<const char *>(&head), sizeof(head));
+    std::uint64_t first_match = 0;
+    for (const entry &entry: entries)
+    {
+      const record stored{*entry.file, first_match, entry.loaded != nullptr ? entry.loaded->match_count : entry.added->size()};
+      out.write(reinterpret_cast<const char *>(&stored), sizeof(stored));
+      first_match += stored.match_count;
+    }
+    for (const entry &entry: entries)
+    {
+      if (entry.loaded != nullptr)
+      {
+        out.write(reinterpret_cast<const char *>(this->matches + entry.loaded->first_match), static_cast<std::streamsize>(entry.loaded->match_count * sizeof(stored_match)));
+        continue;
+      }
+      for (const match &match: *entry.added)
+      {
+        const stored_match stored{match.signature, match.offset};
+        out.write(reinterpret_cast<const char *>(&stored), sizeof(stored));
+      }
+    }
+    out.close();
+    if (!out)
+    {
+      std::error_code error;
+      std::filesystem::remove(temp_path, error);
+      return false;
+    }
+  }
+
+  // Windows won't replace a file that is still mapped
+  this->unload();
+  std::error_code error;
+  std::filesystem::rename(temp_path, this->path, error);
+  if (error)
+  {
+    std::filesystem::remove(temp_path, error);
+    this->load();
+    return false;
+  }
+  this->added.clear();
+  this->load();
+  return true;
+}
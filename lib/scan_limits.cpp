@@ -0,0 +1,64 @@
+#include "scan_limits.hpp"
+
+sigscanner::scan_limits::scan_limits(const sigscanner::scan_options &options)
+        : max_matches(options.max_matches), first_match(options.first_match_per_file), deadline(options.deadline), cancellation(options.cancellation)
+{
+}
+
+bool sigscanner::scan_limits::stopped()
+{
+  if (this->stop.load(std::memory_order_relaxed))
+  {
+    return true;
+  }
+  if ((this->cancellation && this->cancellation->is_cancelled()) || (this->deadline && std::chrono::steady_clock::now() >= *this->deadline))
+  {
+    this->stop = true;
+  }
+  return this->stop;
+}
+
+sigscanner::scan_limits::file_state sigscanner::scan_limits::start_file() const
+{
+  return this->first_match ? std::make_shared<std::atomic<bool>>(false) : nullptr;
+}
+
+bool sigscanner::scan_limits::skip_file(const sigscanner::scan_limits::file_state &file)
+{
+  return (file && file->load(std::memory_order_relaxed)) || this->stopped();
+}
+
+std::size_t sigscanner::scan_limits::claim(std::size_t count, const sigscanner::scan_limits::file_state &file)
+{
+  if (count == 0)
+  {
+    return 0;
+  }
+  if (file)
+  {
+    if (file->exchange(true))
+    {
+      return 0;
+    }
+    count = 1;
+  }
+  if (this->max_matches == 0)
+  {
+    return count;
+  }
+  const std::size_t before = this->claimed.fetch_add(count);
+  if (before + count >= this->max_matches)
+  {
+    this->stop = true;
+  }
+  return before >= this->max_matches ? 0 : std::min(count, this->max_matches - before);
+}
+
+std::size_t sigscanner::scan_limits::match_limit() const
+{
+  if (this->first_match)
+  {
+    return 1;
+  }
+  return this->max_matches;
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include "sigscanner/sigscanner.hpp"
+
+namespace sigscanner
+{
+    /*
+     * The limits from scan_options for a single scan. Once one is reached stopped() stays true, and
+     * every task of the scan checks it before reading or scanning another chunk.
+     */
+    class scan_limits
+    {
+    public:
+        explicit scan_limits(const scan_options &options);
+        scan_limits(const scan_limits &copy) = delete;
+        scan_limits &operator=(const scan_limits &copy) = delete;
+
+        bool stopped();
+
+        /*
+         * State shared by every chunk of one file, null unless only the first match of each file is
+         * wanted. Once a chunk of the file has a match the others can be skipped.
+         */
+        typedef std::shared_ptr<std::atomic<bool>> file_state;
+        file_state start_file() const;
+        bool skip_file(const file_state &file);
+
+        // Claim count matches found in file, returns how many of them may be reported
+        std::size_t claim(std::size_t count, const file_state &file);
+
+        // How many matches a single chunk or buffer needs to look for at most, 0 for no limit
+        std::size_t match_limit() const;
+
+    private:
+        const std::size_t max_matches;
+        const bool first_match;
+        const std::optional<std::chrono::steady_clock::time_point> deadline;
+        const std::optional<cancellation_token> cancellation;
+        std::atomic<std::size_t> claimed = 0;
+        std::atomic<bool> stop = false;
+    };
+}
@@ -20,11 +20,76 @@ void sigscanner::scan_options::set_thread_count(std::size_t count)
   this->thread_count = count;
 }
 
+void sigscanner::scan_options::set_thread_pool(std::shared_ptr<sigscanner::thread_pool> pool)
+{
+  this->pool = std::move(pool);
+}
+
 void sigscanner::scan_options::set_threading_mode(sigscanner::scan_options::threading_mode mode)
 {
   this->threading = mode;
 }
 
+void sigscanner::scan_options::set_read_mode(sigscanner::scan_options::read_mode mode)
+{
+  this->read = mode;
+}
+
+void sigscanner::scan_options::set_max_bytes_in_flight(std::uint64_t bytes)
+{
+  this->max_bytes_in_flight = bytes;
+}
+
+void sigscanner::scan_options::set_max_matches(std::size_t count)
+{
+  this->max_matches = count;
+}
+
+void sigscanner::scan_options::set_first_match_per_file(bool enabled)
+{
+  this->first_match_per_file = enabled;
+}
+
+void sigscanner::scan_options::set_deadline(std::chrono::steady_clock::time_point time)
+{
+  this->deadline = time;
+}
+
+void sigscanner::scan_options::set_cancellation_token(const sigscanner::cancellation_token &token)
+{
+  this->cancellation = token;
+}
+
+void sigscanner::scan_options::set_stats(sigscanner::scan_stats *new_stats)
+{
+  this->stats = new_stats;
+}
+
+void sigscanner::scan_options::set_cache(sigscanner::scan_cache *new_cache)
+{
+  this->cache = new_cache;
+}
+
+void sigscanner::scan_options::set_elf_mode(sigscanner::scan_options::elf_mode mode)
+{
+  this->elf = mode;
+}
+
+void sigscanner::scan_options::add_elf_section(std::string_view new_section)
+{
+  this->elf_sections.push_back(new_section);
+}
+
+void sigscanner::scan_options::add_elf_sections(std::initializer_list<std::string_view> new_sections)
+{
+  this->elf_sections.insert(this->elf_sections.end(), new_sections.begin(), new_sections.end());
+}
+
+void sigscanner::scan_options::add_elf_sections(const std::vector<std::string_view> &new_sections)
+{
+  this->elf_sections.insert(this->elf_sections.end(), new_sections.begin(), new_sections.end());
+}
+
 void sigscanner::scan_options::set_extension_checking_mode(sigscanner::scan_options::extension_checking_mode mode)
 {
   this->extension_checking = mode;
@@ -0,0 +1,25 @@
+#include "sigscanner/sigscanner.hpp"
+
+sigscanner::scan_stats &sigscanner::scan_stats::operator+=(const sigscanner::scan_stats &other)
+{
+  this->files_visited += other.files_visited;
+  this->files_skipped += other.files_skipped;
+  this->files_scanned += other.files_scanned;
+  this->files_cached += other.files_cached;
+  this->bytes_read += other.bytes_read;
+  this->tasks_executed += other.tasks_executed;
+  this->read_time += other.read_time;
+  this->match_time += other.match_time;
+  this->lock_wait_time += other.lock_wait_time;
+  this->queue_wait_time += other.queue_wait_time;
+  if (this->signatures.size() < other.signatures.size())
+  {
+    this->signatures.resize(other.signatures.size());
+  }
+  for (std::size_t i = 0; i < other.signatures.size(); i++)
+  {
+    this->signatures[i].candidates += other.signatures[i].candidates;
+    this->signatures[i].verified += other.signatures[i].verified;
+  }
+  return *this;
+}
@@ -15,6 +15,11 @@ std::vector<sigscanner::offset> sigscanner::scanner::reverse_scan(const sigscann
   return this->multi_scanner.reverse_scan(data, len, options).begin()->second;
 }
 
+std::size_t sigscanner::scanner::scan(const sigscanner::byte *data, std::size_t len, sigscanner::offset *out, std::size_t capacity, bool &overflowed) const
+{
+  return this->multi_scanner.get_signatures().front().scan(data, len, 0, out, capacity, overflowed);
+}
+
 std::vector<sigscanner::offset> sigscanner::scanner::scan_file(const std::filesystem::path &path, const sigscanner::scan_options &options) const
 {
   return this->multi_scanner.scan_file(path, options).begin()->second;
@@ -25,3 +30,24 @@ sigscanner::scanner::scan_directory(const std::filesystem::path &path, const sig
 {
   return this->multi_scanner.scan_directory(path, options).begin()->second;
 }
+
+std::unordered_map<std::filesystem::path, std::vector<sigscanner::offset>>
+sigscanner::scanner::scan_index(const sigscanner::corpus_index &index, const sigscanner::scan_options &options) const
+{
+  return this->multi_scanner.scan_index(index, options).begin()->second;
+}
+
+std::map<sigscanner::process_region, std::vector<sigscanner::offset>> sigscanner::scanner::scan_process(int pid, const sigscanner::scan_options &options) const
+{
+  return this->multi_scanner.scan_process(pid, options).begin()->second;
+}
+
+std::vector<sigscanner::offset> sigscanner::scanner::scan_stream(std::istream &stream, const sigscanner::scan_options &options) const
+{
+  return this->multi_scanner.scan_stream(stream, options).begin()->second;
+}
+
+std::vector<sigscanner::offset> sigscanner::scanner::scan_fd(int fd, const sigscanner::scan_options &options) const
+{
+  return this->multi_scanner.scan_fd(fd, options).begin()->second;
+}
@@ -1,5 +1,9 @@
 #include "sigscanner/sigscanner.hpp"
+#include "kernels.hpp"
+#include "byte_frequency.hpp"
 #include <sstream>
+#include <iomanip>
+#include <limits>
 
 sigscanner::signature::signature(const char *pattern) : signature(std::string_view(pattern))
 {
@@ -28,6 +32,9 @@ sigscanner::signature::signature(std::string_view pattern)
 
   this->length = this->mask.size();
   this->update_hash();
+  this->update_anchors();
+  this->update_engine();
+  this->update_packed();
 }
 
 sigscanner::signature::signature(std::string_view pattern, std::string_view mask)
@@ -37,7 +44,7 @@ sigscanner::signature::signature(std::string_view pattern, std::string_view mask
     return;
   }
 
-  for (std::size_t i = 0; i < this->length; i++)
+  for (std::size_t i = 0; i < mask.size(); i++)
   {
     if (mask[i] == '?')
     {
@@ -45,13 +52,16 @@ sigscanner::signature::signature(std::string_view pattern, std::string_view mask
       this->mask.push_back(mask_type::WILDCARD);
     } else
     {
-      this->pattern.push_back(static_cast<std::uint8_t>(std::strtoul(pattern.substr(i, 2).data(), nullptr, 16) & 0xFF));
+      this->pattern.push_back(static_cast<std::uint8_t>(pattern[i]));
       this->mask.push_back(mask_type::BYTE);
     }
   }
 
   this->length = this->mask.size();
   this->update_hash();
+  this->update_anchors();
+  this->update_engine();
+  this->update_packed();
 }
 
 sigscanner::signature::signature(const sigscanner::signature &copy)
@@ -60,6 +70,14 @@ sigscanner::signature::signature(const sigscanner::signature &copy)
   this->mask = copy.mask;
   this->length = copy.length;
   this->hash = copy.hash;
+  this->first_anchor = copy.first_anchor;
+  this->second_anchor = copy.second_anchor;
+  this->horspool_shift = copy.horspool_shift;
+  this->horspool_end = copy.horspool_end;
+  this->horspool_match_shift = copy.horspool_match_shift;
+  this->selected_engine = copy.selected_engine;
+  this->inline_packed = copy.inline_packed;
+  this->heap_packed = copy.heap_packed;
 }
 
 sigscanner::signature &sigscanner::signature::operator=(const sigscanner::signature &copy)
@@ -71,11 +89,27 @@ sigscanner::signature::signature(sigscanner::signature &&move) noexcept
   this->mask = std::move(move.mask);
   this->length = move.length;
   this->hash = move.hash;
+  this->first_anchor = move.first_anchor;
+  this->second_anchor = move.second_anchor;
+  this->horspool_shift = std::move(move.horspool_shift);
+  this->horspool_end = move.horspool_end;
+  this->horspool_match_shift = move.horspool_match_shift;
+  this->selected_engine = move.selected_engine;
+  this->inline_packed = move.inline_packed;
+  this->heap_packed = std::move(move.heap_packed);
 
   move.pattern.clear();
   move.mask.clear();
   move.length = 0;
   move.hash = 0;
+  move.first_anchor = 0;
+  move.second_anchor = 0;
+  move.horspool_shift.clear();
+  move.horspool_end = 0;
+  move.horspool_match_shift = 0;
+  move.selected_engine = engine::ANCHORED;
+  move.inline_packed.fill(0);
+  move.heap_packed.clear();
 }
 
 sigscanner::signature &sigscanner::signature::operator=(sigscanner::signature &&move) noexcept
@@ -84,11 +118,27 @@ sigscanner::signature &sigscanner::signature::operator=(sigscanner::signature &&
   this->mask = std::move(move.mask);
   this->length = move.length;
   this->hash = move.hash;
+  this->first_anchor = move.first_anchor;
+  this->second_anchor = move.second_anchor;
+  this->horspool_shift = std::move(move.horspool_shift);
+  this->horspool_end = move.horspool_end;
+  this->horspool_match_shift = move.horspool_match_shift;
+  this->selected_engine = move.selected_engine;
+  this->inline_packed = move.inline_packed;
+  this->heap_packed = std::move(move.heap_packed);
 
   move.pattern.clear();
   move.mask.clear();
   move.length = 0;
   move.hash = 0;
+  move.first_anchor = 0;
+  move.second_anchor = 0;
+  move.horspool_shift.clear();
+  move.horspool_end = 0;
+  move.horspool_match_shift = 0;
+  move.selected_engine = engine::ANCHORED;
+  move.inline_packed.fill(0);
+  move.heap_packed.clear();
 
   return *this;
 }
@@ -130,49 +180,126 @@ bool sigscanner::signature::check(const sigscanner::byte *data, std::size_t size
     return false;
   }
 
-  for (std::size_t i = 0; i < this->length; i++)
-  {
-    if (this->mask[i] == mask_type::BYTE && this->pattern[i] != data[i])
-    {
-      return false;
-    }
-  }
+  return sigscanner::kernels::verify_packed(this->packed(), this->length, data);
+}
 
-  return true;
+std::vector<sigscanner::offset> sigscanner::signature::scan(const sigscanner::byte *data, std::size_t size, sigscanner::offset base, std::size_t max_matches) const
+{
+  return this->scan_internal(data, size, base, max_matches, nullptr);
 }
 
-std::vector<sigscanner::offset> sigscanner::signature::scan(const sigscanner::byte *data, std::size_t size, sigscanner::offset base) const
+std::vector<sigscanner::offset> sigscanner::signature::scan(const sigscanner::byte *data, std::size_t size, sigscanner::offset base, std::size_t max_matches,
+                                                             std::uint64_t &candidates) const
 {
-  std::vector<sigscanner::offset> offsets;
-  if (size < this->length)
+  return this->scan_internal(data, size, base, max_matches, &candidates);
+}
+
+std::vector<sigscanner::offset> sigscanner::signature::reverse_scan(const sigscanner::byte *data, std::size_t size, sigscanner::offset base, std::size_t max_matches) const
+{
+  return this->reverse_scan_internal(data, size, base, max_matches, nullptr);
+}
+
+std::vector<sigscanner::offset> sigscanner::signature::reverse_scan(const sigscanner::byte *data, std::size_t size, sigscanner::offset base, std::size_t max_matches,
+                                                                     std::uint64_t &candidates) const
+{
+  return this->reverse_scan_internal(data, size, base, max_matches, &candidates);
+}
+
+std::size_t sigscanner::signature::scan(const sigscanner::byte *data, std::size_t size, sigscanner::offset base, sigscanner::offset *out, std::size_t capacity,
+                                         bool &overflowed) const
+{
+  std::size_t count = 0;
+  overflowed = !this->for_each_match(data, size, base, [out, capacity, &count](sigscanner::offset offset) {
+      if (count == capacity)
+      {
+        return false;
+      }
+      out[count++] = offset;
+      return true;
+  });
+  return count;
+}
+
+std::size_t sigscanner::signature::find_matches(const sigscanner::byte *data, std::size_t size, std::size_t start, std::size_t *positions, std::size_t capacity,
+                                                 std::uint64_t *candidates) const
+{
+  if (this->length == 0 || size < this->length)
   {
-    return offsets;
+    return 0;
   }
-
-  for (const byte *ptr = data; ptr < data + size - this->length; ptr++)
+  std::size_t found = 0;
+  if (this->first_anchor == this->length)
   {
-    if (this->check(ptr, this->length))
+    // Only wildcards, every position matches
+    for (std::size_t pos = start; pos <= size - this->length && found < capacity; pos++)
+    {
+      positions[found++] = pos;
+    }
+    if (candidates != nullptr)
     {
-      offsets.push_back(base + (ptr - data));
+      *candidates += found;
     }
+    return found;
+  }
+
+  const sigscanner::kernels::pattern_view view = this->view(candidates);
+  for (std::size_t pos = start; found < capacity && (pos = sigscanner::kernels::find(view, data, size, pos)) != sigscanner::kernels::npos; pos++)
+  {
+    positions[found++] = pos;
   }
+  return found;
+}
 
+std::vector<sigscanner::offset> sigscanner::signature::scan_internal(const sigscanner::byte *data, std::size_t size, sigscanner::offset base, std::size_t max_matches,
+                                                                      std::uint64_t *candidates) const
+{
+  std::vector<sigscanner::offset> offsets;
+  if (max_matches == 0)
+  {
+    max_matches = std::numeric_limits<std::size_t>::max();
+  }
+  const auto add = [&offsets, max_matches](sigscanner::offset offset) {
+      offsets.push_back(offset);
+      return offsets.size() < max_matches;
+  };
+  this->for_each_match_internal(data, size, base, add, candidates);
   return offsets;
 }
 
-std::vector<sigscanner::offset> sigscanner::signature::reverse_scan(const sigscanner::byte *data, std::size_t size, sigscanner::offset base) const
+std::vector<sigscanner::offset> sigscanner::signature::reverse_scan_internal(const sigscanner::byte *data, std::size_t size, sigscanner::offset base, std::size_t max_matches,
+                                                                              std::uint64_t *candidates) const
 {
   std::vector<offset> offsets;
-  if (size < this->length)
+  if (this->length == 0 || size < this->length)
   {
     return offsets;
   }
+  if (max_matches == 0)
+  {
+    max_matches = std::numeric_limits<std::size_t>::max();
+  }
+
+  if (this->first_anchor == this->length)
+  {
+    for (std::size_t pos = size - this->length + 1; pos-- > 0 && offsets.size() < max_matches;)
+    {
+      offsets.push_back(base + pos);
+    }
+    if (candidates != nullptr)
+    {
+      *candidates += offsets.size();
+    }
+    return offsets;
+  }
 
-  for (const byte *ptr = data + size - this->length; ptr >= data; ptr--)
+  const sigscanner::kernels::pattern_view view = this->view(candidates);
+  for (std::size_t pos = sigscanner::kernels::rfind(view, data, size, size - this->length); pos != sigscanner::kernels::npos;
+       pos = pos > 0 ? sigscanner::kernels::rfind(view, data, size, pos - 1) : sigscanner::kernels::npos)
   {
-    if (this->check(ptr, this->length))
+    offsets.push_back(base + pos);
+    if (offsets.size() == max_matches)
     {
-      offsets.push_back(base + (ptr - data));
+      break;
     }
   }
 
@@ -190,3 +317,197 @@ void sigscanner::signature::update_hash()
   std::size_t h2 = std::hash<std::string_view>{}(std::string_view(reinterpret_cast<const char *>(this->mask.data()), this->length));
   this->hash = h1 ^ (h2 << 1);
 }
+
+/*
+ * Pick the two rarest BYTEs according to byte_frequency. The rarest is searched for with memchr or
+ * SIMD compares, so a signature starting with wildcards or common bytes like 48 8B only pays for
+ * positions where its rarest bytes line up.
+ */
+void sigscanner::signature::update_anchors()
+{
+  this->first_anchor = this->length;
+  this->second_anchor = this->length;
+  for (std::size_t i = 0; i < this->length; i++)
+  {
+    if (this->mask[i] != mask_type::BYTE)
+    {
+      continue;
+    }
+    const std::uint16_t frequency = sigscanner::byte_frequency[this->pattern[i]];
+    if (this->first_anchor == this->length || frequency < sigscanner::byte_frequency[this->pattern[this->first_anchor]])
+    {
+      this->second_anchor = this->first_anchor;
+      this->first_anchor = i;
+    } else if (this->second_anchor == this->length || frequency < sigscanner::byte_frequency[this->pattern[this->second_anchor]])
+    {
+      this->second_anchor = i;
+    }
+  }
+  if (this->second_anchor == this->length)
+  {
+    this->second_anchor = this->first_anchor;
+  }
+}
+
+sigscanner::signature::anchor_info sigscanner::signature::anchor() const
+{
+  anchor_info info;
+  if (this->first_anchor == this->length)
+  {
+    return info;
+  }
+
+  info.offset = this->first_anchor;
+  info.value = this->pattern[this->first_anchor];
+  info.second_offset = this->second_anchor;
+  info.second_value = this->pattern[this->second_anchor];
+  info.candidate_rate = static_cast<double>(sigscanner::byte_frequency[info.value]) / sigscanner::byte_frequency_total;
+  if (info.second_offset != info.offset)
+  {
+    info.candidate_rate *= static_cast<double>(sigscanner::byte_frequency[info.second_value]) / sigscanner::byte_frequency_total;
+  }
+
+  std::size_t run_start = 0;
+  for (std::size_t i = 0; i <= this->length; i++)
+  {
+    if (i == this->length || this->mask[i] == mask_type::WILDCARD)
+    {
+      if (i - run_start > info.run_length)
+      {
+        info.run_offset = run_start;
+        info.run_length = i - run_start;
+      }
+      run_start = i + 1;
+    }
+  }
+
+  return info;
+}
+
+/*
+ * A wildcard at position j limits every shift to horspool_end - j, so the window used for skipping
+ * ends at whichever literal run needs the fewest steps per byte of machine code. Bytes after the
+ * window are only checked when verifying.
+ *
+ * Horspool is picked if those steps are expected to cost less than the anchored kernel, which tests
+ * a vector (or memchr block) of positions at a time plus whatever candidates pass its filter. Short
+ * shifts on common bytes like 00 dominate, so Horspool usually only wins when the anchors are common.
+ */
+void sigscanner::signature::update_engine()
+{
+  this->horspool_shift.clear();
+  this->horspool_end = 0;
+  this->horspool_match_shift = 0;
+  this->selected_engine = engine::ANCHORED;
+  if (this->length < SIGSCANNER_HORSPOOL_MIN_LENGTH || this->first_anchor == this->length)
+  {
+    return;
+  }
+
+  std::vector<std::uint16_t> shift(256);
+  double best_steps_per_byte = 1.0;
+  for (std::size_t end = 0; end < this->length; end++)
+  {
+    if (this->mask[end] != mask_type::BYTE || (end + 1 < this->length && this->mask[end + 1] == mask_type::BYTE))
+    {
+      continue; // Only the last BYTE of each run
+    }
+    std::size_t cap = end + 1;
+    std::fill(shift.begin(), shift.end(), static_cast<std::uint16_t>(std::min<std::size_t>(cap, 0xFFFF)));
+    for (std::size_t j = 0; j < end; j++)
+    {
+      if (this->mask[j] == mask_type::WILDCARD)
+      {
+        cap = end - j;
+      } else
+      {
+        shift[this->pattern[j]] = static_cast<std::uint16_t>(std::min<std::size_t>(end - j, 0xFFFF));
+      }
+    }
+    double steps_per_byte = 0.0;
+    for (std::size_t c = 0; c < 256; c++)
+    {
+      shift[c] = static_cast<std::uint16_t>(std::min<std::size_t>(shift[c], cap));
+      steps_per_byte += static_cast<double>(sigscanner::byte_frequency[c]) / sigscanner::byte_frequency_total / shift[c];
+    }
+    if (steps_per_byte < best_steps_per_byte)
+    {
+      best_steps_per_byte = steps_per_byte;
+      this->horspool_shift = shift;
+      this->horspool_end = end;
+    }
+  }
+  if (this->horspool_shift.empty())
+  {
+    return;
+  }
+  this->horspool_match_shift = this->horspool_shift[this->pattern[this->horspool_end]];
+  this->horspool_shift[this->pattern[this->horspool_end]] = 0;
+
+  // Rough cycle costs, measured on x86-64 .text
+  constexpr double horspool_step_cost = 4.0;
+  constexpr double candidate_cost = 8.0;
+  const double first_rate = static_cast<double>(sigscanner::byte_frequency[this->pattern[this->first_anchor]]) / sigscanner::byte_frequency_total;
+  const double second_rate = static_cast<double>(sigscanner::byte_frequency[this->pattern[this->second_anchor]]) / sigscanner::byte_frequency_total;
+  double anchored_cost;
+  switch (sigscanner::get_simd_level())
+  {
+    case simd_level::AVX512:
+      anchored_cost = 1.0 / 64 + first_rate * second_rate * candidate_cost;
+      break;
+    case simd_level::AVX2:
+      anchored_cost = 1.0 / 32 + first_rate * second_rate * candidate_cost;
+      break;
+    case simd_level::SSE2:
+      anchored_cost = 1.0 / 16 + first_rate * second_rate * candidate_cost;
+      break;
+    default:
+      anchored_cost = 1.0 / 16 + first_rate * candidate_cost; // memchr only filters on the first anchor
+      break;
+  }
+  if (best_steps_per_byte * horspool_step_cost < anchored_cost)
+  {
+    this->selected_engine = engine::HORSPOOL;
+  }
+}
+
+sigscanner::signature::engine sigscanner::signature::get_engine() const
+{
+  return this->selected_engine;
+}
+
+void sigscanner::signature::set_engine(sigscanner::signature::engine new_engine)
+{
+  if (new_engine == engine::HORSPOOL && this->horspool_shift.empty())
+  {
+    return;
+  }
+  this->selected_engine = new_engine;
+}
+
+void sigscanner::signature::update_packed()
+{
+  const std::size_t words = sigscanner::kernels::packed_words(this->length);
+  this->inline_packed.fill(0);
+  this->heap_packed.clear();
+  if (words <= inline_packed_words)
+  {
+    sigscanner::kernels::pack(this->pattern.data(), this->mask.data(), this->length, this->inline_packed.data());
+  } else
+  {
+    this->heap_packed.resize(words);
+    sigscanner::kernels::pack(this->pattern.data(), this->mask.data(), this->length, this->heap_packed.data());
+  }
+}
+
+const std::uint64_t *sigscanner::signature::packed() const
+{
+  return this->heap_packed.empty() ? this->inline_packed.data() : this->heap_packed.data();
+}
+
+sigscanner::kernels::pattern_view sigscanner::signature::view(std::uint64_t *candidates) const
+{
+  const bool horspool = this->selected_engine == engine::HORSPOOL;
+  return {this->pattern.data(), this->packed(), this->length, this->first_anchor, this->second_anchor,
+          horspool ? this->horspool_shift.data() : nullptr, this->horspool_end, this->horspool_match_shift, candidates};
+}
@@ -0,0 +1,29 @@
+#include "stats_shards.hpp"
+#include <algorithm>
+
+sigscanner::stats_shards::stats_shards(std::size_t signature_count)
+        : signature_count(signature_count), shards([signature_count] {
+            sigscanner::scan_stats stats;
+            stats.signatures.resize(signature_count);
+            return stats;
+        })
+{
+}
+
+sigscanner::scan_stats &sigscanner::stats_shards::local()
+{
+  return this->shards.local();
+}
+
+sigscanner::scan_stats sigscanner::stats_shards::merge() const
+{
+  sigscanner::scan_stats merged;
+  merged.signatures.resize(this->signature_count);
+  for (const sigscanner::scan_stats &shard: this->shards)
+  {
+    merged += shard;
+  }
+  // Every file is visited on one thread and may be scanned on another, so only the totals can be compared
+  merged.files_skipped = merged.files_visited - std::min(merged.files_scanned + merged.files_cached, merged.files_visited);
+  return merged;
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include "sigscanner/sigscanner.hpp"
+#include "thread_shards.hpp"
+
+namespace sigscanner
+{
+    /*
+     * One scan_stats per thread, so counting never touches memory another thread is writing. Added
+     * up once the scan has finished.
+     */
+    class stats_shards
+    {
+    public:
+        typedef std::chrono::steady_clock clock;
+
+        explicit stats_shards(std::size_t signature_count);
+        stats_shards(const stats_shards &copy) = delete;
+        stats_shards &operator=(const stats_shards &copy) = delete;
+
+        // The calling thread's counters
+        scan_stats &local();
+
+        // Must not be called while anything is still being counted
+        scan_stats merge() const;
+
+    private:
+        const std::size_t signature_count;
+        thread_shards<scan_stats> shards;
+    };
+
+    /*
+     * Adds the time until it goes out of scope to one of the calling thread's counters, or does nothing
+     * if stats is null.
+     */
+    class stats_timer
+    {
+    public:
+        stats_timer(stats_shards *stats, std::chrono::nanoseconds scan_stats::*counter)
+                : stats(stats), counter(counter), start(stats != nullptr ? stats_shards::clock::now() : stats_shards::clock::time_point())
+        {
+        }
+
+        ~stats_timer()
+        {
+          if (this->stats != nullptr)
+          {
+            this->stats->local().*this->counter += stats_shards::clock::now() - this->start;
+          }
+        }
+
+        stats_timer(const stats_timer &copy) = delete;
+        stats_timer &operator=(const stats_timer &copy) = delete;
+
+    private:
+        stats_shards *const stats;
+        std::chrono::nanoseconds scan_stats::*const counter;
+        const stats_shards::clock::time_point start;
+    };
+}
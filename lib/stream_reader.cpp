@@ -0,0 +1,45 @@
+#include "stream_reader.hpp"
+#include <algorithm>
+#include <limits>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#include <cerrno>
+#endif
+
+sigscanner::stream_reader sigscanner::read_stream(std::istream &stream)
+{
+  return [&stream](sigscanner::byte *data, std::uint64_t size) {
+      // read() keeps going until it has size bytes or the stream ends, however little each underlying read returns
+      stream.read(reinterpret_cast<char *>(data), static_cast<std::streamsize>(size));
+      return static_cast<std::uint64_t>(stream.gcount());
+  };
+}
+
+sigscanner::stream_reader sigscanner::read_fd(int fd)
+{
+  return [fd](sigscanner::byte *data, std::uint64_t size) {
+      // Pipes hand over whatever has been written so far, so keep reading until the block is full
+      std::uint64_t done = 0;
+      while (done < size)
+      {
+#ifdef _WIN32
+        const int read = _read(fd, data + done, static_cast<unsigned int>(std::min<std::uint64_t>(size - done, std::numeric_limits<int>::max())));
+#else
+        const ssize_t read = ::read(fd, data + done, static_cast<std::size_t>(std::min<std::uint64_t>(size - done, std::numeric_limits<ssize_t>::max())));
+        if (read < 0 && errno == EINTR)
+        {
+          continue;
+        }
+#endif
+        if (read <= 0)
+        {
+          break;
+        }
+        done += static_cast<std::uint64_t>(read);
+      }
+      return done;
+  };
+}
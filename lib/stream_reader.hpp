@@ -0,0 +1,16 @@
+#pragma once
+
+#include "sigscanner/sigscanner.hpp"
+#include <istream>
+
+namespace sigscanner
+{
+    /*
+     * Fills data with up to size bytes of something that can only be read front to back once, like a
+     * pipe. Returns how many were read, which is less than size only at the end or after an error.
+     */
+    typedef std::function<std::uint64_t(byte *data, std::uint64_t size)> stream_reader;
+
+    stream_reader read_stream(std::istream &stream);
+    stream_reader read_fd(int fd); // Not closed. Retried when interrupted by a signal
+}
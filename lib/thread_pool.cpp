@@ -1,7 +1,19 @@
 #include "sigscanner/sigscanner.hpp"
-#include <chrono>
+#include "stats_shards.hpp"
+#include <algorithm>
+#include <iterator>
 
-using namespace std::chrono_literals;
+namespace
+{
+    // Lets add_task push to the calling worker's own queue
+    thread_local const sigscanner::thread_pool *current_pool = nullptr;
+    thread_local std::size_t current_index = 0;
+}
+
+sigscanner::thread_pool::thread_pool(std::size_t count)
+{
+  this->create(count);
+}
 
 sigscanner::thread_pool::~thread_pool()
 {
@@ -15,19 +27,32 @@ void sigscanner::thread_pool::create(std::size_t count)
     return;
   }
 
+  count = std::max<std::size_t>(count, 1);
   this->running = true;
+  this->queues.clear();
+  for (std::size_t i = 0; i < count; i++)
+  {
+    this->queues.push_back(std::make_unique<task_queue>());
+  }
   this->threads.reserve(count);
   for (std::size_t i = 0; i < count; i++)
   {
-    this->threads.emplace_back(&sigscanner::thread_pool::thread_loop, this);
+    this->threads.emplace_back(&sigscanner::thread_pool::thread_loop, this, i);
   }
 }
 
 void sigscanner::thread_pool::destroy(bool force)
 {
+  if (!force && this->running)
+  {
+    this->wait();
+  }
   this->force_stop = force;
-  this->running = false;
-  std::this_thread::sleep_for(10ms);
+  {
+    std::lock_guard<std::mutex> lock(this->park_mutex);
+    this->running = false;
+  }
+  this->park_condition.notify_all();
   for (auto &thread: this->threads)
   {
     if (thread.joinable())
@@ -36,19 +61,114 @@ void sigscanner::thread_pool::destroy(bool force)
     }
   }
   this->threads.clear();
-  this->tasks.clear();
+  for (auto &queue: this->queues)
+  {
+    this->pending -= queue->tasks.size();
+    queue->tasks.clear();
+  }
+  this->pending -= this->shared_queue.tasks.size();
+  this->shared_queue.tasks.clear();
+  this->pending -= this->sized_tasks.size();
+  this->sized_tasks.clear();
+  this->sized_queued = 0;
+  this->queued = 0;
   this->force_stop = false; // Setting here means we don't have to check running before locking in thread_loop
 }
 
+std::size_t sigscanner::thread_pool::size() const
+{
+  return this->threads.size();
+}
+
 void sigscanner::thread_pool::add_task(std::function<void()> &&task)
 {
-  std::lock_guard<std::mutex> lock(this->tasks_mutex);
-  this->tasks.emplace_back(std::move(task));
+  this->push_task(std::move(task), nullptr);
+}
+
+void sigscanner::thread_pool::add_task(std::function<void()> &&task, std::uint64_t size)
+{
+  this->push_task(std::move(task), size, nullptr);
+}
+
+void sigscanner::thread_pool::push_task(std::function<void()> &&task, sigscanner::thread_pool::task_group *group)
+{
+  this->pending++;
+  task_queue &queue = current_pool == this ? *this->queues[current_index] : this->shared_queue;
+  {
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    queue.tasks.push_back({std::move(task), group});
+  }
+  this->queued++;
+  this->wake_worker();
+}
+
+void sigscanner::thread_pool::push_task(std::function<void()> &&task, std::uint64_t size, sigscanner::thread_pool::task_group *group)
+{
+  this->pending++;
+  {
+    std::lock_guard<std::mutex> lock(this->sized_mutex);
+    this->sized_tasks.push_back({size, std::move(task), group});
+    std::push_heap(this->sized_tasks.begin(), this->sized_tasks.end());
+    this->sized_queued++;
+  }
+  this->queued++;
+  this->wake_worker();
 }
 
-void sigscanner::thread_pool::thread_loop()
+void sigscanner::thread_pool::wake_worker()
 {
-  std::unique_lock<std::mutex> lock(this->tasks_mutex, std::defer_lock);
+  // A worker going to sleep either sees the new task or is counted in sleeping, so taking the lock can't miss it
+  if (this->sleeping > 0)
+  {
+    std::lock_guard<std::mutex> lock(this->park_mutex);
+  }
+  this->park_condition.notify_one();
+}
+
+void sigscanner::thread_pool::wait()
+{
+  std::unique_lock<std::mutex> lock(this->idle_mutex);
+  this->idle_condition.wait(lock, [this] {
+      return this->pending == 0;
+  });
+}
+
+bool sigscanner::thread_pool::run_pending_task()
+{
+  // Threads outside the pool have no queue of their own, so they only take from the shared queue or steal
+  const std::size_t index = current_pool == this ? current_index : this->queues.size();
+  std::function<void()> task;
+  if (!this->pop_task(index, task))
+  {
+    return false;
+  }
+  this->run_task(task);
+  return true;
+}
+
+bool sigscanner::thread_pool::run_group_task(const sigscanner::thread_pool::task_group &group)
+{
+  const std::size_t index = current_pool == this ? current_index : this->queues.size();
+  std::function<void()> task;
+  if (!this->pop_task(index, task, &group))
+  {
+    return false;
+  }
+  this->run_task(task);
+  return true;
+}
+
+void sigscanner::thread_pool::run_task(std::function<void()> &task)
+{
+  task();
+  task = nullptr;
+  this->finish_task();
+}
+
+void sigscanner::thread_pool::thread_loop(std::size_t index)
+{
+  current_pool = this;
+  current_index = index;
   std::function<void()> task;
   while (true)
   {
@@ -56,36 +176,204 @@ void sigscanner::thread_pool::thread_loop()
     {
       return;
     }
+    if (this->pop_task(index, task))
+    {
+      this->run_task(task);
+      continue;
+    }
+
+    std::unique_lock<std::mutex> lock(this->park_mutex);
+    this->sleeping++;
+    this->park_condition.wait(lock, [this] {
+        return this->queued > 0 || !this->running || this->force_stop;
+    });
+    this->sleeping--;
+    if (this->force_stop || (!this->running && this->queued == 0))
+    {
+      return;
+    }
+  }
+}
+
+/*
+ * Sized tasks first. Then the own queue, oldest task first so files and chunks are scanned roughly in
+ * the order they were added. Then the shared queue, then the newest task of another worker.
+ *
+ * A group's waiter searches past the other groups' tasks for its own, so queues are walked rather
+ * than only looked at from the end. The group's queued count drops as soon as a task is taken.
+ */
+bool sigscanner::thread_pool::pop_task(std::size_t index, std::function<void()> &task, const sigscanner::thread_pool::task_group *group)
+{
+  if (this->queued == 0 || (group != nullptr && group->queued == 0))
+  {
+    return false;
+  }
+  const auto taken = [this](task_group *owner) {
+      this->queued--;
+      if (owner != nullptr)
+      {
+        owner->queued--;
+      }
+  };
+  const auto take = [&task, group, &taken](task_queue &queue, bool newest) {
+      std::lock_guard<std::mutex> lock(queue.mutex);
+      const auto matches = [group](const queued_task &queued) { return group == nullptr || queued.group == group; };
+      std::deque<queued_task>::iterator found;
+      if (newest)
+      {
+        const auto reverse_found = std::find_if(queue.tasks.rbegin(), queue.tasks.rend(), matches);
+        if (reverse_found == queue.tasks.rend())
+        {
+          return false;
+        }
+        found = std::prev(reverse_found.base());
+      } else
+      {
+        found = std::find_if(queue.tasks.begin(), queue.tasks.end(), matches);
+        if (found == queue.tasks.end())
+        {
+          return false;
+        }
+      }
+      task = std::move(found->task);
+      task_group *owner = found->group;
+      queue.tasks.erase(found);
+      taken(owner);
+      return true;
+  };
+
+  if (this->sized_queued > 0)
+  {
+    std::lock_guard<std::mutex> lock(this->sized_mutex);
+    if (this->sized_tasks.empty())
+    {
+      // Taken since sized_queued was read
+    } else if (group == nullptr)
     {
-      lock.lock();
-      if (this->tasks.empty())
+      std::pop_heap(this->sized_tasks.begin(), this->sized_tasks.end());
+    } else
+    {
+      // The group's largest. Only a few big files' ranges are ever queued this way, so searching and rebuilding the heap is cheap
+      auto found = this->sized_tasks.end();
+      for (auto sized = this->sized_tasks.begin(); sized != this->sized_tasks.end(); sized++)
       {
-        lock.unlock();
-        if (!this->running)
+        if (sized->group == group && (found == this->sized_tasks.end() || *found < *sized))
         {
-          return;
+          found = sized;
         }
-        /*
-         * Benchmarked on a 5950X running Arch Linux with 30 threads
-         * Method:            % spent in scan_file_internal
-         * sleep_for(5ms)     50.73, 47.45, 51.21   = 49.77
-         * sleep_for(4ms)     51.82, 47.34, 45.44   = 48.20
-         * sleep_for(3ms)     50.67, 50.52, 52.35   = 51.18
-         * sleep_for(2ms)     42.13, 40.33, 41.83   = 41.43
-         * sleep_for(1ms)     34.55, 32.60, 37.44   = 34.86
-         * sleep_for(0ms)     12.04, 13.21, 12.93   = 12.73
-         * yield()            12.89, 12.89, 12.59   = 12.79
-         * spinning           10.12, 11.68, 10.41   = 10.74
-         *
-         * This tells us somewhere between 2-5ms is the sweet spot (for this system).
-         */
-        std::this_thread::sleep_for(3ms);
-        continue;
       }
-      task = std::move(this->tasks.back());
-      this->tasks.pop_back();
-      lock.unlock();
+      if (found != this->sized_tasks.end())
+      {
+        std::iter_swap(found, this->sized_tasks.end() - 1);
+        std::make_heap(this->sized_tasks.begin(), this->sized_tasks.end() - 1);
+      }
+    }
+    if (!this->sized_tasks.empty() && (group == nullptr || this->sized_tasks.back().group == group))
+    {
+      this->sized_queued--;
+      task = std::move(this->sized_tasks.back().task);
+      task_group *owner = this->sized_tasks.back().group;
+      this->sized_tasks.pop_back();
+      taken(owner);
+      return true;
+    }
+  }
+
+  const bool own_queue = index < this->queues.size();
+  if ((own_queue && take(*this->queues[index], false)) || take(this->shared_queue, false))
+  {
+    return true;
+  }
+  for (std::size_t i = own_queue ? 1 : 0; i < this->queues.size(); i++)
+  {
+    if (take(*this->queues[(index + i) % this->queues.size()], true))
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+void sigscanner::thread_pool::finish_task()
+{
+  if (--this->pending == 0)
+  {
+    std::lock_guard<std::mutex> lock(this->idle_mutex);
+    this->idle_condition.notify_all();
+  }
+}
+
+sigscanner::thread_pool::task_group::task_group(sigscanner::thread_pool &pool, sigscanner::stats_shards *stats) : pool(pool), stats(stats)
+{
+}
+
+sigscanner::thread_pool::task_group::~task_group()
+{
+  this->wait();
+}
+
+void sigscanner::thread_pool::task_group::add_task(std::function<void()> &&task)
+{
+  this->pool.push_task(this->track(std::move(task)), this);
+  this->condition.notify_all();
+}
+
+void sigscanner::thread_pool::task_group::add_task(std::function<void()> &&task, std::uint64_t size)
+{
+  this->pool.push_task(this->track(std::move(task)), size, this);
+  this->condition.notify_all();
+}
+
+std::function<void()> sigscanner::thread_pool::task_group::track(std::function<void()> &&task)
+{
+  {
+    // Counted before it is queued so a worker taking it can't take the count below zero. Under the lock so a waiter can't miss it
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->pending++;
+    this->queued++;
+  }
+  if (this->stats != nullptr)
+  {
+    task = [this, task = std::move(task), queued = sigscanner::stats_shards::clock::now()] {
+        sigscanner::scan_stats &local = this->stats->local();
+        local.queue_wait_time += sigscanner::stats_shards::clock::now() - queued;
+        local.tasks_executed++;
+        task();
+    };
+  }
+  return [this, task = std::move(task)] {
+      task();
+      // Decremented under the lock so wait() can't return and destroy the group while this is still using it
+      std::lock_guard<std::mutex> lock(this->mutex);
+      if (--this->pending == 0)
+      {
+        this->condition.notify_all();
+      }
+  };
+}
+
+void sigscanner::thread_pool::task_group::wait()
+{
+  /*
+   * Only the group's own tasks are run here, tasks of other scans sharing the pool are left to the
+   * workers. While the rest of the group is running on workers this sleeps, until they finish or
+   * queue more of it
+   */
+  while (true)
+  {
+    std::unique_lock<std::mutex> lock(this->mutex);
+    this->condition.wait(lock, [this] {
+        return this->pending == 0 || this->queued > 0;
+    });
+    if (this->pending == 0)
+    {
+      return;
+    }
+    lock.unlock();
+    if (!this->pool.run_group_task(*this))
+    {
+      // Counted but not in a queue yet, or taken by a worker in between
+      std::this_thread::yield();
     }
-    task();
   }
 }
@@ -0,0 +1,90 @@
+#pragma once
+
+#include "sigscanner/sigscanner.hpp"
+#include <array>
+#include <deque>
+#include <thread>
+
+#ifndef SIGSCANNER_THREAD_SHARD_CACHE_SIZE
+#define SIGSCANNER_THREAD_SHARD_CACHE_SIZE 8 // Instances each thread remembers its shard of, a worker on a shared pool moves between several scans' tasks
+#endif
+
+namespace sigscanner
+{
+    /*
+     * One T per thread that uses an instance, so threads never write to memory another one is writing.
+     * Each instance has an id no other instance ever gets, and a thread caches which shard is its own
+     * for the last few ids it used, so finding it is usually a short search without a lock. Otherwise
+     * the thread's shard is looked up by thread, so however tasks of different instances interleave on
+     * a thread it only ever gets one shard of each. Shards are kept in a deque so they stay put when more
+     * are added.
+     *
+     * Iterating the shards must wait until no thread is using the instance anymore.
+     */
+    template<typename T>
+    class thread_shards
+    {
+    public:
+        explicit thread_shards(std::function<T()> make = [] { return T(); })
+                : id(next_id()), make(std::move(make))
+        {
+        }
+
+        thread_shards(const thread_shards &copy) = delete;
+        thread_shards &operator=(const thread_shards &copy) = delete;
+
+        T &local()
+        {
+          thread_local std::array<std::pair<std::uint64_t, T *>, SIGSCANNER_THREAD_SHARD_CACHE_SIZE> cache{};
+          thread_local std::size_t next_slot = 0;
+          for (const auto &[cached_id, shard]: cache)
+          {
+            if (cached_id == this->id)
+            {
+              return *shard;
+            }
+          }
+          T *shard;
+          {
+            std::lock_guard<std::mutex> lock(this->shards_mutex);
+            auto [found, added] = this->thread_shard.try_emplace(std::this_thread::get_id(), nullptr);
+            if (added)
+            {
+              found->second = &this->shards.emplace_back(this->make());
+            }
+            shard = found->second;
+          }
+          cache[next_slot] = {this->id, shard};
+          next_slot = (next_slot + 1) % cache.size();
+          return *shard;
+        }
+
+        typename std::deque<T>::iterator begin()
+        { return this->shards.begin(); }
+
+        typename std::deque<T>::iterator end()
+        { return this->shards.end(); }
+
+        typename std::deque<T>::const_iterator begin() const
+        { return this->shards.begin(); }
+
+        typename std::deque<T>::const_iterator end() const
+        { return this->shards.end(); }
+
+        std::size_t size() const
+        { return this->shards.size(); }
+
+    private:
+        static std::uint64_t next_id()
+        {
+          static std::atomic<std::uint64_t> next = 1;
+          return next++;
+        }
+
+        const std::uint64_t id;
+        const std::function<T()> make;
+        std::mutex shards_mutex;
+        std::unordered_map<std::thread::id, T *> thread_shard;
+        std::deque<T> shards;
+    };
+}
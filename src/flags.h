@@ -60,7 +60,8 @@ namespace flags
                 on_value(item);
                 return;
               }
-              item.at(0) == '-' ? on_option(item) : on_value(item);
+              // A lone dash is a value, conventionally standing for stdin
+              item.at(0) == '-' && item.size() > 1 ? on_option(item) : on_value(item);
             }
 
             // Consumes the current option if there is one.
@@ -121,17 +122,14 @@ namespace flags
         inline std::vector<std::string_view> get_values(
                 const argument_map &options, const std::string_view &option)
         {
+          // Only the option's own entries, a bucket may hold other options too
           std::vector<std::string_view> values;
-          if (options.bucket_count() == 0) return values;
-          argument_map::size_type bucket = options.bucket(option);
-          values.reserve(options.bucket_size(bucket));
-          auto iter = options.cbegin(bucket);
-          auto end = options.cend(bucket);
-          while (iter != end)
+          auto [iter, end] = options.equal_range(option);
+          for (; iter != end; ++iter)
           {
-            values.emplace_back(iter++->second.value());
+            if (iter->second) values.emplace_back(*iter->second);
           }
-          return std::move(values);
+          return values;
         }
 
         // Coerces the string value of the given option into <T>.
@@ -3,24 +3,235 @@
 #include <iostream>
 #include <filesystem>
 #include <string>
+#include <iomanip>
+#include <fstream>
+#include <map>
+#include <algorithm>
+#include <cctype>
+
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#endif
 
 static std::string binary_name;
 
 void print_help()
 {
   std::cout << "Recursively scan all files for a given signature\n\n"
-               "Usage: " << binary_name <<
-            " <signature> [path] [options]\n"
+               "Usage: " << binary_name << " <signature> [path] [options]\n"
+               "       " << binary_name << " -f <file> [path] [options]\n"
+               "       " << binary_name << " --build-index <file> [path] [options]\n"
+               "       " << binary_name << " <signature> --pid <pid> [options]\n"
             "The signature should be an IDA-style pattern e.g. '?? A7 98 52 ?? 32 AD 72'\n"
-            "If a path is not specified the current directory will be used\n\n"
+            "A signature file has one pattern per line, optionally named: 'name: ?? A7 98 52'. Unnamed signatures are labelled with their pattern. Blank lines and lines starting with # are skipped\n"
+            "If a path is not specified the current directory will be used. A path of - reads from stdin, e.g. zstd -dc image.zst | " << binary_name << " <signature> -\n\n"
             "Flags:\n"
+            "-f <file>              - Scan for every signature in this file at once, matches are labelled with the signature's quoted name\n"
             "--depth <int>          - How many levels of subdirectory should be scanned. 1 for example means scan the directory and the directories in it\n"
             "--no-recurse           - Only scan files in this directory\n"
             "-j <int>               - Number of threads to use for scanning\n"
-            "--ext <extension>      - Filter by file extension. Can be specified 0 or more times. Should include the dot or empty for no extension: --ext '' --ext '.so'"
+            "--ext <extension>      - Filter by file extension. Can be specified 0 or more times. Should include the dot or empty for no extension: --ext '' --ext '.so'\n"
+            "--explain              - Print which bytes of the signature are used to find candidates\n"
+            "--mmap                 - Memory map files instead of reading them in blocks\n"
+            "--async                - Read blocks ahead with io_uring while scanning (Linux)\n"
+            "-l                     - Only list the files containing the signature, each file is scanned up to its first match\n"
+            "-m <int>               - Stop after this many matches in total\n"
+            "--stats                - Print where the scan spent its time\n"
+            "--elf                  - Only scan the executable sections of ELF files, printing the virtual address of each match after its offset. Other files are scanned whole\n"
+            "--elf-segments         - Like --elf, but scan the executable loadable segments\n"
+            "--section <name>       - Like --elf, but scan this section instead. Can be specified more than once: --section .text --section .init\n"
+            "--cache <file>         - Keep results in this file, so later scans with the same signatures only read files that are new or have changed\n"
+            "--build-index <file>   - Instead of scanning, index which n-grams appear where in the files under path and write it to this file. Takes about 64MB of memory per thread, and free space of about 3 times the index size next to it while it is written\n"
+            "--index <file>         - Scan the files of this index instead of a path, reading only the blocks that can contain a match\n"
+            "--pid <pid>            - Scan the memory of this running process instead of a path, printing the addresses of matches under the mapping they are in (Linux)"
             << std::endl;
 }
 
+struct named_signature
+{
+    std::string name;
+    sigscanner::signature signature;
+};
+
+std::string_view trim(std::string_view text)
+{
+  const std::size_t start = text.find_first_not_of(" \t\r");
+  if (start == std::string_view::npos)
+  {
+    return {};
+  }
+  return text.substr(start, text.find_last_not_of(" \t\r") - start + 1);
+}
+
+/*
+ * Check every whitespace separated token of an IDA-style pattern is ?, ?? or exactly two hex digits, and
+ * write it out the way signature's constructor expects. signature parses leniently, so "7G" would
+ * otherwise scan as a byte.
+ */
+bool normalize_pattern(std::string_view text, std::string &pattern)
+{
+  pattern.clear();
+  std::size_t start = 0;
+  while ((start = text.find_first_not_of(" \t", start)) != std::string_view::npos)
+  {
+    const std::size_t end = std::min(text.find_first_of(" \t", start), text.size());
+    const std::string_view token = text.substr(start, end - start);
+    start = end;
+    if (!pattern.empty())
+    {
+      pattern += ' ';
+    }
+    if (token == "?" || token == "??")
+    {
+      pattern += "??";
+    } else if (token.size() == 2 && std::isxdigit(static_cast<unsigned char>(token[0])) && std::isxdigit(static_cast<unsigned char>(token[1])))
+    {
+      pattern += token;
+    } else
+    {
+      return false;
+    }
+  }
+  return !pattern.empty();
+}
+
+/*
+ * Read a signature file. Patterns can't contain a colon, so everything before the last one on a line
+ * is the name. Unnamed signatures are named after their pattern. Prints the offending line and
+ * returns false if any pattern is invalid.
+ */
+bool load_signatures(const std::filesystem::path &path, std::vector<named_signature> &signatures)
+{
+  std::ifstream file(path);
+  if (!file)
+  {
+    std::cerr << "Error: Could not open signature file " << path << std::endl;
+    return false;
+  }
+  std::string line;
+  for (std::size_t line_number = 1; std::getline(file, line); line_number++)
+  {
+    const std::string_view text = trim(line);
+    if (text.empty() || text.front() == '#')
+    {
+      continue;
+    }
+    const std::size_t separator = text.rfind(':');
+    const std::string_view pattern = separator == std::string_view::npos ? text : trim(text.substr(separator + 1));
+    const std::string_view name = separator == std::string_view::npos ? text : trim(text.substr(0, separator));
+    std::string normalized;
+    if (!normalize_pattern(pattern, normalized))
+    {
+      std::cerr << "Error: Invalid signature on line " << line_number << " of " << path << ": " << text << std::endl;
+      return false;
+    }
+    sigscanner::signature sig(normalized);
+    signatures.push_back({std::string(name.empty() ? pattern : name), std::move(sig)});
+  }
+  if (signatures.empty())
+  {
+    std::cerr << "Error: No signatures in " << path << std::endl;
+    return false;
+  }
+  return true;
+}
+
+void print_anchor(const sigscanner::signature &sig)
+{
+  const sigscanner::signature::anchor_info anchor = sig.anchor();
+  if (anchor.run_length == 0)
+  {
+    std::cerr << "Signature has no fixed bytes, every position matches" << std::endl;
+    return;
+  }
+  std::cerr << std::hex << std::setfill('0')
+            << "Anchor: 0x" << std::setw(2) << static_cast<std::uint32_t>(anchor.value) << std::dec << " at offset " << anchor.offset
+            << ", then 0x" << std::hex << std::setw(2) << static_cast<std::uint32_t>(anchor.second_value) << std::dec << " at offset " << anchor.second_offset << "\n"
+            << "Expected to verify " << anchor.candidate_rate * 100.0 << "% of positions\n"
+            << "Longest literal run: " << anchor.run_length << " bytes at offset " << anchor.run_offset << "\n"
+            << "Engine: " << (sig.get_engine() == sigscanner::signature::engine::HORSPOOL ? "Horspool" : "anchored") << std::endl;
+}
+
+void print_stats(const sigscanner::scan_stats &stats, const std::vector<named_signature> &signatures, bool labelled)
+{
+  const auto milliseconds = [](std::chrono::nanoseconds time) {
+      return std::chrono::duration<double, std::milli>(time).count();
+  };
+  std::cerr << std::dec << std::fixed << std::setprecision(1)
+            << "Files: " << stats.files_visited << " visited, " << stats.files_skipped << " skipped, " << stats.files_scanned << " scanned, " << stats.files_cached << " cached\n"
+            << "Bytes read: " << stats.bytes_read << "\n"
+            << "Tasks executed: " << stats.tasks_executed << "\n"
+            << "Read: " << milliseconds(stats.read_time) << " ms, match: " << milliseconds(stats.match_time) << " ms, lock wait: "
+            << milliseconds(stats.lock_wait_time) << " ms, queue wait: " << milliseconds(stats.queue_wait_time) << " ms (summed over threads)\n";
+  for (std::size_t i = 0; i < stats.signatures.size(); i++)
+  {
+    if (labelled)
+    {
+      std::cerr << std::quoted(signatures[i].name) << ": ";
+    }
+    std::cerr << "Candidates: " << stats.signatures[i].candidates << ", verified: " << stats.signatures[i].verified << "\n";
+  }
+  std::cerr << std::flush;
+}
+
+/*
+ * Print the matches gathered for each file or region, under print_key unless a single file was scanned.
+ * With list_only only the keys are printed, with print_addresses the address of each match follows its offset.
+ */
+template<typename key, typename key_printer>
+void print_results(std::map<key, std::vector<sigscanner::match>> &results, bool print_keys, bool list_only, bool print_addresses, bool labelled,
+                   const std::vector<named_signature> &signatures, const key_printer &print_key)
+{
+  for (auto &[result_key, matches]: results)
+  {
+    if (list_only || print_keys)
+    {
+      print_key(result_key);
+      std::cout << "\n";
+    }
+    if (list_only)
+    {
+      continue;
+    }
+    // Chunks arrive in any order
+    std::sort(matches.begin(), matches.end(), [](const sigscanner::match &a, const sigscanner::match &b) {
+        return a.offset != b.offset ? a.offset < b.offset : a.signature < b.signature;
+    });
+    for (const sigscanner::match &match: matches)
+    {
+      std::cout << (print_keys ? "  " : "");
+      if (labelled)
+      {
+        std::cout << std::quoted(signatures[match.signature].name) << " ";
+      }
+      std::cout << "0x" << std::hex << match.offset;
+      if (print_addresses)
+      {
+        std::cout << " (0x" << match.address << ")";
+      }
+      std::cout << std::dec << "\n";
+    }
+  }
+  std::cout << std::endl;
+}
+
+// The options deciding which files are scanned and how many threads scan them, shared by scanning and building an index
+sigscanner::scan_options walk_options(const flags::args &args)
+{
+  sigscanner::scan_options scan_options;
+  scan_options.set_thread_count(args.get("j", 1));
+  scan_options.set_threading_mode(sigscanner::scan_options::threading_mode::AUTO);
+  scan_options.add_extensions(args.values("ext"));
+  int depth = args.get("depth", -1);
+  if (args.get<bool>("no-recurse"))
+  {
+    depth = 0;
+  }
+  scan_options.set_max_depth(depth);
+  return scan_options;
+}
+
 int main(int argc, char **argv)
 {
   binary_name = std::filesystem::path(argv[0]).filename().string();
@@ -33,65 +244,212 @@ int main(int argc, char **argv)
   }
 
   const std::vector<std::string_view> &positional_args = args.positional();
-  if (positional_args.empty())
+  const std::optional<std::string> build_index_path = args.get<std::string>("build-index");
+  if (build_index_path)
   {
-    std::cerr << "Error: No signature specified" << std::endl;
-    print_help();
-    return 1;
+    // No signature is needed to build an index, so the path comes first
+    std::filesystem::path path = !positional_args.empty() ? positional_args[0] : std::filesystem::current_path();
+    if (!std::filesystem::exists(path))
+    {
+      std::cerr << "Error: Path does not exist" << std::endl;
+      print_help();
+      return 1;
+    }
+    path = std::filesystem::canonical(path);
+    if (!sigscanner::corpus_index::build(path, *build_index_path, walk_options(args)))
+    {
+      std::cerr << "Error: Could not build index " << *build_index_path << std::endl;
+      return 1;
+    }
+    std::cout << "Indexed " << sigscanner::corpus_index(*build_index_path).file_count() << " files" << std::endl;
+    return 0;
   }
 
-  const sigscanner::signature sig(positional_args[0]);
-  if (sig.size() == 0)
+  std::vector<named_signature> signatures;
+  const std::optional<std::string> signature_file = args.get<std::string>("f");
+  const bool labelled = signature_file.has_value();
+  if (labelled)
   {
-    std::cerr << "Error: Invalid signature" << std::endl;
-    print_help();
-    return 1;
+    if (!load_signatures(*signature_file, signatures))
+    {
+      return 1;
+    }
+  } else
+  {
+    if (positional_args.empty())
+    {
+      std::cerr << "Error: No signature specified" << std::endl;
+      print_help();
+      return 1;
+    }
+    std::string normalized;
+    if (!normalize_pattern(positional_args[0], normalized))
+    {
+      std::cerr << "Error: Invalid signature" << std::endl;
+      print_help();
+      return 1;
+    }
+    sigscanner::signature sig(normalized);
+    signatures.push_back({std::string(positional_args[0]), std::move(sig)});
   }
 
-  std::filesystem::path path = positional_args.size() > 1 ? positional_args[1] : std::filesystem::current_path();
-  if (!std::filesystem::exists(path))
+  if (args.get<bool>("explain"))
   {
-    std::cerr << "Error: Path does not exist" << std::endl;
-    print_help();
-    return 1;
+    for (const named_signature &named: signatures)
+    {
+      if (labelled)
+      {
+        std::cerr << std::quoted(named.name) << ":\n";
+      }
+      print_anchor(named.signature);
+    }
   }
-  path = std::filesystem::canonical(path);
-
-  std::size_t thread_count = args.get("j", 1);
-  sigscanner::scanner scanner(sig);
-  sigscanner::scan_options scan_options;
-  scan_options.set_thread_count(thread_count);
-  scan_options.add_extensions(args.values("ext"));
 
-  if (std::filesystem::is_directory(path))
+  // An index replaces the path, it lists the files to scan itself. So does a process, its memory is scanned instead of files
+  const std::optional<std::string> index_path = args.get<std::string>("index");
+  std::optional<sigscanner::corpus_index> index;
+  const bool scan_process = args.get<std::string>("pid").has_value();
+  const std::optional<int> pid = args.get<int>("pid");
+  std::filesystem::path path;
+  bool scan_stdin = false;
+  if (index_path)
   {
-    int depth = args.get("depth", -1);
-    if (args.get<bool>("no-recurse"))
+    index.emplace(*index_path);
+    if (!index->is_open())
     {
-      depth = 0;
+      std::cerr << "Error: " << *index_path << " is not a valid index" << std::endl;
+      return 1;
     }
-    scan_options.set_max_depth(depth);
-    const auto results = scanner.scan_directory(path, scan_options);
-    for (const auto &[file, file_results]: results)
+  } else if (scan_process)
+  {
+    if (!pid || sigscanner::get_process_regions(*pid).empty())
     {
-      std::cout << file << "\n";
-      for (const auto &offset: file_results)
-      {
-        std::cout << "  0x" << std::hex << offset << "\n";
-      }
+      std::cerr << "Error: Could not read the memory map of process " << *args.get<std::string>("pid") << std::endl;
+      return 1;
     }
-    std::cout << std::endl;
-  } else if (std::filesystem::is_regular_file(path))
+  } else
   {
-    const auto results = scanner.scan_file(path, scan_options);
-    for (const auto &offset: results)
+    // With a signature file the path is the first positional argument instead of the second
+    const std::size_t path_arg = labelled ? 0 : 1;
+    path = positional_args.size() > path_arg ? positional_args[path_arg] : std::filesystem::current_path();
+    scan_stdin = path == "-";
+    if (!scan_stdin && !std::filesystem::exists(path))
+    {
+      std::cerr << "Error: Path does not exist" << std::endl;
+      print_help();
+      return 1;
+    }
+    // Pipes, like the /dev/fd paths of process substitution, have nothing to resolve to
+    std::error_code error;
+    if (std::filesystem::path resolved = std::filesystem::canonical(path, error); !scan_stdin && !error)
     {
-      std::cout << "0x" << std::hex << offset << "\n";
+      path = std::move(resolved);
     }
-    std::cout << std::endl;
+  }
+
+  sigscanner::multi_scanner scanner;
+  for (const named_signature &named: signatures)
+  {
+    scanner.add_signature(named.signature);
+  }
+  sigscanner::scan_options scan_options = walk_options(args);
+  if (args.get<bool>("mmap"))
+  {
+    scan_options.set_read_mode(sigscanner::scan_options::read_mode::MMAP);
+  } else if (args.get<bool>("async"))
+  {
+    scan_options.set_read_mode(sigscanner::scan_options::read_mode::ASYNC);
+  }
+  // Naming a section implies scanning sections
+  const std::vector<std::string_view> elf_sections = args.values("section");
+  const bool elf = args.get<bool>("elf") || args.get<bool>("elf-segments") || !elf_sections.empty();
+  if (args.get<bool>("elf-segments"))
+  {
+    scan_options.set_elf_mode(sigscanner::scan_options::elf_mode::SEGMENTS);
+  } else if (elf)
+  {
+    scan_options.set_elf_mode(sigscanner::scan_options::elf_mode::SECTIONS);
+    scan_options.add_elf_sections(elf_sections);
+  }
+  const bool list_files = args.get<bool>("l").value_or(false);
+  scan_options.set_first_match_per_file(list_files);
+  scan_options.set_max_matches(args.get<std::size_t>("m", 0));
+  sigscanner::scan_stats stats;
+  const bool print_scan_stats = args.get<bool>("stats").value_or(false);
+  if (print_scan_stats)
+  {
+    scan_options.set_stats(&stats);
+  }
+  const std::optional<std::string> cache_path = args.get<std::string>("cache");
+  std::optional<sigscanner::scan_cache> cache;
+  if (cache_path)
+  {
+    cache.emplace(*cache_path);
+    scan_options.set_cache(&*cache);
+  }
+
+  if (!index && pid)
+  {
+    std::map<sigscanner::process_region, std::vector<sigscanner::match>> results;
+    const bool read = scanner.scan_process(*pid, [&results](const sigscanner::process_region &region, const std::vector<sigscanner::match> &matches) {
+        std::vector<sigscanner::match> &region_results = results[region];
+        region_results.insert(region_results.end(), matches.begin(), matches.end());
+    }, scan_options);
+    if (!read)
+    {
+      std::cerr << "Error: Could not read the memory of process " << *pid << ", it may not exist or need more permissions" << std::endl;
+      return 1;
+    }
+    if (print_scan_stats)
+    {
+      print_stats(stats, signatures, labelled);
+    }
+    // Regions are listed like /proc/<pid>/maps does, with the addresses of the matches under them
+    print_results(results, true, list_files, false, labelled, signatures, [](const sigscanner::process_region &region) {
+        std::cout << std::hex << region.start << "-" << region.end << std::dec << " " << region.permissions << (region.name.empty() ? "" : " ") << region.name;
+    });
+    return 0;
+  }
+
+  // Every signature is matched in the same pass over each file, the sink gathers them per file
+  std::map<std::filesystem::path, std::vector<sigscanner::match>> results;
+  const sigscanner::match_sink sink = [&results](const std::filesystem::path &file, const std::vector<sigscanner::match> &matches) {
+      std::vector<sigscanner::match> &file_results = results[file];
+      file_results.insert(file_results.end(), matches.begin(), matches.end());
+  };
+  // Files are listed with their matches unless a single file was scanned
+  const bool directory = index || (!scan_stdin && std::filesystem::is_directory(path));
+  if (index)
+  {
+    scanner.scan_index(*index, sink, scan_options);
+  } else if (scan_stdin)
+  {
+#ifdef _WIN32
+    _setmode(0, _O_BINARY); // Opened in text mode, which would translate line endings
+#endif
+    scanner.scan_fd(0, sink, scan_options);
+  } else if (directory)
+  {
+    scanner.scan_directory(path, sink, scan_options);
+  } else if (std::filesystem::is_regular_file(path) || std::filesystem::is_fifo(path) || std::filesystem::is_character_file(path)
+             || std::filesystem::is_block_file(path))
+  {
+    scanner.scan_file(path, sink, scan_options);
   } else
   {
     std::cerr << "File of invalid type specified" << std::endl;
     return 1;
   }
-}
\ No newline at end of file
+  if (print_scan_stats)
+  {
+    print_stats(stats, signatures, labelled);
+  }
+  if (cache && !cache->save())
+  {
+    std::cerr << "Error: Could not save cache to " << *cache_path << std::endl;
+  }
+
+  print_results(results, directory, list_files, elf, labelled, signatures, [](const std::filesystem::path &file) {
+      std::cout << file;
+  });
+}
@@ -0,0 +1,95 @@
+#include "sigscanner/sigscanner.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <iostream>
+#include <memory>
+#include <random>
+
+#ifdef __linux__
+#include <csignal>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+/*
+ * Fork a child holding a buffer of random bytes and scan its memory for them. After the fork the
+ * buffer is at the same address in the child, so that is where the match has to be. Once the child
+ * is gone the scan has to fail rather than quietly find nothing. Exits with 77, which ctest counts as
+ * skipped, where processes can't be scanned.
+ */
+
+static int failures = 0;
+
+static void check(bool condition, const char *what)
+{
+  if (!condition)
+  {
+    std::cerr << "FAILED: " << what << std::endl;
+    failures++;
+  }
+}
+
+int main()
+{
+#ifdef __linux__
+  constexpr std::size_t marker_size = 32;
+  std::unique_ptr<sigscanner::byte[]> marker(new sigscanner::byte[marker_size]);
+  std::mt19937_64 random(std::random_device{}());
+  std::generate(marker.get(), marker.get() + marker_size, [&random] { return static_cast<sigscanner::byte>(random()); });
+  std::string pattern;
+  for (std::size_t i = 0; i < marker_size; i++)
+  {
+    char hex[4];
+    std::snprintf(hex, sizeof(hex), i == 0 ? "%02X" : " %02X", static_cast<unsigned>(marker[i]));
+    pattern += hex;
+  }
+
+  const pid_t child = fork();
+  if (child < 0)
+  {
+    std::cerr << "fork failed" << std::endl;
+    return 1;
+  }
+  if (child == 0)
+  {
+    // Killed by the parent
+    while (true)
+    {
+      pause();
+    }
+  }
+
+  const sigscanner::multi_scanner scanner{sigscanner::signature(pattern)};
+  std::vector<sigscanner::offset> found;
+  const bool read = scanner.scan_process(child, [&found](const sigscanner::process_region &, const std::vector<sigscanner::match> &matches) {
+      for (const sigscanner::match &match: matches)
+      {
+        found.push_back(match.offset);
+      }
+  });
+  kill(child, SIGKILL);
+  waitpid(child, nullptr, 0);
+  if (!read && found.empty())
+  {
+    std::cerr << "Can't read the memory of a child process here, skipping" << std::endl;
+    return 77;
+  }
+  check(read, "scan_process of a running child returns true");
+  check(std::find(found.begin(), found.end(), reinterpret_cast<std::uintptr_t>(marker.get())) != found.end(),
+        "The child's copy of the marker is found at its address");
+
+  bool called = false;
+  check(!scanner.scan_process(child, [&called](const sigscanner::process_region &, const std::vector<sigscanner::match> &) { called = true; }),
+        "scan_process of an exited child returns false");
+  check(!called, "Nothing is reported for an exited child");
+
+  if (failures == 0)
+  {
+    std::cout << "Passed" << std::endl;
+  }
+  return failures == 0 ? 0 : 1;
+#else
+  std::cerr << "Processes can only be scanned on Linux, skipping" << std::endl;
+  return 77;
+#endif
+}